@@ -102,6 +102,7 @@ SOURCES += \
     src/dsp/afsk1200/costabf.c \
     src/dsp/agc_impl.cpp \
     src/dsp/correct_iq_cc.cpp \
+    src/dsp/fft_planner.cpp \
     src/dsp/filter/fir_decim.cpp \
     src/dsp/lpf.cpp \
     src/dsp/rds/decoder_impl.cc \
@@ -115,6 +116,7 @@ SOURCES += \
     src/dsp/rx_meter.cpp \
     src/dsp/rx_noise_blanker_cc.cpp \
     src/dsp/rx_rds.cpp \
+    src/dsp/signal_tracker.cpp \
     src/dsp/sniffer_f.cpp \
     src/dsp/stereo_demod.cpp \
     src/interfaces/udp_sink_f.cpp \
@@ -139,6 +141,8 @@ SOURCES += \
     src/qtgui/nb_options.cpp \
     src/qtgui/plotter.cpp \
     src/qtgui/qtcolorpicker.cpp \
+    src/qtgui/waterfall_history.cpp \
+    src/qtgui/waterfall_logger.cpp \
     src/receivers/nbrx.cpp \
     src/receivers/receiver_base.cpp \
     src/receivers/wfmrx.cpp
@@ -154,6 +158,7 @@ HEADERS += \
     src/dsp/afsk1200/filter-i386.h \
     src/dsp/agc_impl.h \
     src/dsp/correct_iq_cc.h \
+    src/dsp/fft_planner.h \
     src/dsp/filter/fir_decim.h \
     src/dsp/filter/fir_decim_coef.h \
     src/dsp/lpf.h \
@@ -173,6 +178,7 @@ HEADERS += \
     src/dsp/rx_meter.h \
     src/dsp/rx_noise_blanker_cc.h \
     src/dsp/rx_rds.h \
+    src/dsp/signal_tracker.h \
     src/dsp/sniffer_f.h \
     src/dsp/stereo_demod.h \
     src/interfaces/udp_sink_f.h \
@@ -198,6 +204,8 @@ HEADERS += \
     src/qtgui/nb_options.h \
     src/qtgui/plotter.h \
     src/qtgui/qtcolorpicker.h \
+    src/qtgui/waterfall_history.h \
+    src/qtgui/waterfall_logger.h \
     src/receivers/nbrx.h \
     src/receivers/receiver_base.h \
     src/receivers/wfmrx.h
@@ -261,7 +269,8 @@ PKGCONFIG += gnuradio-analog \
              gnuradio-filter \
              gnuradio-fft \
              gnuradio-runtime \
-             gnuradio-osmosdr
+             gnuradio-osmosdr \
+             fftw3f
 
 # Detect GNU Radio version and link against log4cpp for 3.8
 GNURADIO_VERSION = $$system(pkg-config --modversion gnuradio-runtime)
@@ -21,6 +21,7 @@
  * the Free Software Foundation, Inc., 51 Franklin Street,
  * Boston, MA 02110-1301, USA.
  */
+#include <cmath>
 #include <string>
 #include <vector>
 
@@ -52,6 +53,7 @@
 #include "ui_mainwindow.h"
 
 /* DSP */
+#include "dsp/fft_planner.h"
 #include "receiver.h"
 #include "remote_control_settings.h"
 
@@ -63,7 +65,9 @@ MainWindow::MainWindow(const QString cfgfile, bool edit_conf, QWidget *parent) :
     ui(new Ui::MainWindow),
     d_lnb_lo(0),
     d_hw_freq(0),
-    d_fftAvg(0.25),
+    d_peakDetection(false),
+    d_tracking(false),
+    d_wf_history_mb(-1),
     d_have_audio(true),
     dec_afsk1200(0)
 {
@@ -90,10 +94,23 @@ MainWindow::MainWindow(const QString cfgfile, bool edit_conf, QWidget *parent) :
 
     d_filter_shape = receiver::FILTER_SHAPE_NORMAL;
 
+    /* load FFTW wisdom before the first FFT objects are created */
+    QDir().mkpath(m_cfg_dir);
+    fft_planner::load_wisdom(QString("%1/fftw_wisdom").arg(m_cfg_dir).toStdString());
+
     /* create receiver object */
     rx = new receiver("", "", 1);
     rx->set_rf_freq(144500000.0f);
 
+    // hardware settings are applied in the receiver's control thread
+    rx->set_hw_callback([this](receiver::hw_setting setting,
+                               const std::string &name, double value) {
+        QMetaObject::invokeMethod(this, "hwSettingApplied", Qt::QueuedConnection,
+                                  Q_ARG(int, setting),
+                                  Q_ARG(QString, QString::fromStdString(name)),
+                                  Q_ARG(double, value));
+    });
+
     // remote controller
     remote = new RemoteControl();
 
@@ -108,11 +125,13 @@ MainWindow::MainWindow(const QString cfgfile, bool edit_conf, QWidget *parent) :
     audio_fft_timer = new QTimer(this);
     connect(audio_fft_timer, SIGNAL(timeout()), this, SLOT(audioFftTimeout()));
 
-    d_fftData = new std::complex<float>[MAX_FFT_SIZE];
     d_realFftData = new float[MAX_FFT_SIZE];
     d_iirFftData = new float[MAX_FFT_SIZE];
     for (int i = 0; i < MAX_FFT_SIZE; i++)
         d_iirFftData[i] = -140.0;  // dBFS
+    d_fftZoom = false;
+    d_fftZoomCenter = 0;
+    d_fftZoomSpan = 0;
 
     /* timer for data decoders */
     dec_timer = new QTimer(this);
@@ -229,8 +248,12 @@ MainWindow::MainWindow(const QString cfgfile, bool edit_conf, QWidget *parent) :
     connect(uiDockFft, SIGNAL(fftRateChanged(int)), this, SLOT(setIqFftRate(int)));
     connect(uiDockFft, SIGNAL(fftWindowChanged(int)), this, SLOT(setIqFftWindow(int)));
     connect(uiDockFft, SIGNAL(wfSpanChanged(quint64)), this, SLOT(setWfTimeSpan(quint64)));
+    connect(uiDockFft, SIGNAL(wfHistoryChanged(int)), this, SLOT(setWfHistorySize(int)));
     connect(uiDockFft, SIGNAL(fftSplitChanged(int)), this, SLOT(setIqFftSplit(int)));
     connect(uiDockFft, SIGNAL(fftAvgChanged(float)), this, SLOT(setIqFftAvg(float)));
+    connect(uiDockFft, SIGNAL(fftWelchChanged(int,float)), this, SLOT(setIqFftWelch(int,float)));
+    connect(uiDockFft, SIGNAL(fftThreadsChanged(int,int)), this, SLOT(setIqFftThreads(int,int)));
+    connect(uiDockFft, SIGNAL(fftZoomModeToggled(bool)), this, SLOT(setIqFftZoomMode(bool)));
     connect(uiDockFft, SIGNAL(fftZoomChanged(float)), ui->plotter, SLOT(zoomOnXAxis(float)));
     connect(uiDockFft, SIGNAL(resetFftZoom()), ui->plotter, SLOT(resetHorizontalZoom()));
     connect(uiDockFft, SIGNAL(gotoFftCenter()), ui->plotter, SLOT(moveToCenterFreq()));
@@ -257,6 +280,10 @@ MainWindow::MainWindow(const QString cfgfile, bool edit_conf, QWidget *parent) :
     // Bookmarks
     connect(uiDockBookmarks, SIGNAL(newBookmarkActivated(qint64, QString, int)), this, SLOT(onBookmarkActivated(qint64, QString, int)));
     connect(uiDockBookmarks->actionAddBookmark, SIGNAL(triggered()), this, SLOT(on_actionAddBookmark_triggered()));
+    connect(uiDockBookmarks->actionAddDetected, SIGNAL(triggered()), this, SLOT(addDetectedBookmarks()));
+    connect(uiDockBookmarks, SIGNAL(visibilityChanged(bool)), this, SLOT(updateTracking()));
+    connect(&Bookmarks::Get(), SIGNAL(BookmarksChanged()), ui->plotter, SLOT(updateBookmarks()));
+    connect(&Bookmarks::Get(), SIGNAL(TagListChanged()), ui->plotter, SLOT(updateBookmarks()));
 
 
     // I/Q playback
@@ -282,6 +309,9 @@ MainWindow::MainWindow(const QString cfgfile, bool edit_conf, QWidget *parent) :
     connect(ui->plotter, SIGNAL(newFilterFreq(int, int)), remote, SLOT(setPassband(int, int)));
     connect(remote, SIGNAL(newPassband(int)), this, SLOT(setPassband(int)));
     connect(remote, SIGNAL(gainChanged(QString, double)), uiDockInputCtl, SLOT(setGain(QString,double)));
+    connect(remote, SIGNAL(startScan(QList<qint64>, int, double, int)), this, SLOT(startScan(QList<qint64>, int, double, int)));
+    connect(remote, SIGNAL(stopScan()), this, SLOT(stopScan()));
+    connect(remote, SIGNAL(signalClientsChanged()), this, SLOT(updateTracking()));
 
     rds_timer = new QTimer(this);
     connect(rds_timer, SIGNAL(timeout()), this, SLOT(rdsTimeout()));
@@ -327,6 +357,19 @@ MainWindow::MainWindow(const QString cfgfile, bool edit_conf, QWidget *parent) :
         }
     }
 
+    // Create FFTW plans for the current FFT size and its neighbours in the
+    // background. Sizes already in the wisdom file are instant. Other sizes
+    // are planned when selected, so a large measurement never holds the
+    // FFTW planner lock for long at startup.
+    std::vector<unsigned int> fft_sizes;
+    unsigned int fft_size = uiDockFft->fftSize();
+    fft_sizes.push_back(fft_size);
+    if (fft_size * 2 <= MAX_FFT_SIZE)
+        fft_sizes.push_back(fft_size * 2);
+    if (fft_size / 2 >= 1024)
+        fft_sizes.push_back(fft_size / 2);
+    fft_planner::preplan(fft_sizes);
+
     qsvg_dummy = new QSvgWidget();
 }
 
@@ -334,6 +377,8 @@ MainWindow::~MainWindow()
 {
     on_actionDSP_triggered(false);
 
+    fft_planner::stop();
+
     /* stop and delete timers */
     dec_timer->stop();
     delete dec_timer;
@@ -347,6 +392,9 @@ MainWindow::~MainWindow()
     audio_fft_timer->stop();
     delete audio_fft_timer;
 
+    // don't exit while the bookmarks file is being written
+    Bookmarks::Get().flush();
+
     if (m_settings)
     {
         m_settings->setValue("configversion", 2);
@@ -376,9 +424,11 @@ MainWindow::~MainWindow()
     delete uiDockFft;
     delete uiDockInputCtl;
     delete uiDockRDS;
+
+    // remote closes its clients, don't update the tracker of a deleted rx
+    remote->disconnect(this);
     delete rx;
     delete remote;
-    delete [] d_fftData;
     delete [] d_realFftData;
     delete [] d_iirFftData;
     delete qsvg_dummy;
@@ -473,6 +523,7 @@ bool MainWindow::loadConfig(const QString cfgfile, bool check_crash,
     {
         try
         {
+            cancelScan("DEVICE");
             rx->set_input_device(indev.toStdString());
             conf_ok = true;
         }
@@ -581,9 +632,8 @@ bool MainWindow::loadConfig(const QString cfgfile, bool check_crash,
     if (conv_ok)
     {
         // set analog bw even if 0 since for some devices 0 Hz means "auto"
-        double actual_bw = rx->set_analog_bandwidth((double) int64_val);
+        rx->set_analog_bandwidth((double) int64_val);
         qDebug() << "Requested bandwidth:" << int64_val << "Hz";
-        qDebug() << "Actual bandwidth   :" << actual_bw << "Hz";
     }
 
     uiDockInputCtl->readSettings(m_settings); // this will also update freq range
@@ -591,6 +641,9 @@ bool MainWindow::loadConfig(const QString cfgfile, bool check_crash,
     uiDockFft->readSettings(m_settings);
     uiDockAudio->readSettings(m_settings);
 
+    // the history is only opened here if readSettings() has not changed it
+    setWfHistorySize(uiDockFft->wfHistorySize());
+
     {
         int64_val = m_settings->value("input/frequency", 14236000).toLongLong(&conv_ok);
 
@@ -823,6 +876,7 @@ void MainWindow::setNewFrequency(qint64 rx_freq)
     d_hw_freq = (qint64)hw_freq;
 
     // set receiver frequency
+    cancelScan("TUNE");
     rx->set_rf_freq(hw_freq);
 
     // update widgets
@@ -882,6 +936,90 @@ void MainWindow::setFilterOffset(qint64 freq_hz)
     }
 }
 
+/**
+ * @brief A hardware setting has been applied by the receiver.
+ * @param setting The receiver::hw_setting.
+ * @param name The gain stage or antenna name.
+ * @param value The value reported by the device.
+ */
+void MainWindow::hwSettingApplied(int setting, QString name, double value)
+{
+    Q_UNUSED(name);
+
+    if (setting == receiver::HW_BANDWIDTH)
+        qDebug() << "Actual bandwidth   :" << value << "Hz";
+}
+
+/**
+ * @brief Start the scanner (from remote control).
+ * @param freqs The frequencies to scan in Hz, LNB LO included.
+ * @param dwell_ms Time on each frequency before the level is measured.
+ * @param threshold Signal level in dBFS that stops the scanner.
+ * @param hold_ms Time to stay on a frequency after the signal has faded.
+ *
+ * The receiver tunes the hardware itself while scanning; the GUI follows
+ * when the scan is stopped.
+ */
+void MainWindow::startScan(QList<qint64> freqs, int dwell_ms, double threshold,
+                           int hold_ms)
+{
+    std::vector<double> rx_freqs;
+
+    rx_freqs.reserve(freqs.size());
+    for (int i = 0; i < freqs.size(); i++)
+        rx_freqs.push_back((double)(freqs[i] - d_lnb_lo));
+
+    if (rx->start_scan(rx_freqs, dwell_ms, (float)threshold, hold_ms) !=
+        receiver::STATUS_OK)
+        remote->setScanStopped("ERROR");
+}
+
+/** Stop the scanner and tune the GUI to the frequency it stopped on. */
+void MainWindow::stopScan()
+{
+    if (rx->is_scanning())
+    {
+        rx->stop_scan();
+        readScanEvents();
+
+        qint64 rx_freq = d_lnb_lo + (qint64)(rx->get_rf_freq() + rx->get_filter_offset());
+        setNewFrequency(rx_freq);
+        remote->setNewFrequency(rx_freq);
+    }
+
+    remote->setScanStopped("REQUEST");
+}
+
+/**
+ * @brief Stop a running scan because the receiver is about to change.
+ * @param reason The reason reported to the remote control clients.
+ *
+ * Called before the receiver is retuned, stopped or gets a new input
+ * device. The receiver would stop the scan itself, but the remote control
+ * has to know about it.
+ */
+void MainWindow::cancelScan(const QString &reason)
+{
+    if (!rx->is_scanning())
+        return;
+
+    rx->stop_scan();
+    readScanEvents();
+    remote->setScanStopped(reason);
+}
+
+/** Pass the scanner events to the remote control. */
+void MainWindow::readScanEvents()
+{
+    rx->get_scan_events(d_scan_events);
+    for (size_t i = 0; i < d_scan_events.size(); i++)
+    {
+        const receiver::scan_event &event = d_scan_events[i];
+
+        remote->setScanEvent(event.found, d_lnb_lo + (qint64)event.freq, event.level);
+    }
+}
+
 /**
  * @brief Set a specific gain.
  * @param name The name of the gain stage to adjust.
@@ -1258,19 +1396,33 @@ void MainWindow::meterTimeout()
     level = rx->get_signal_pwr(true);
     ui->sMeter->setLevel(level);
     remote->setSignalLevel(level);
+
+    readScanEvents();
 }
 
 /** Baseband FFT plot timeout. */
 void MainWindow::iqFftTimeout()
 {
     unsigned int    fftsize;
-    unsigned int    i;
-    float           pwr;
-    float           pwr_scale;
-    std::complex<float> pt;     /* a single FFT point used in calculations */
+    double          center;
+    double          bandwidth;
+
+    // follow the span shown on the plotter
+    if (d_fftZoom)
+    {
+        qint64 span_center = ui->plotter->getFftCenterFreq();
+        qint64 span = ui->plotter->getSpanFreq();
+
+        if (span_center != d_fftZoomCenter || span != d_fftZoomSpan)
+        {
+            d_fftZoomCenter = span_center;
+            d_fftZoomSpan = span;
+            rx->set_iq_fft_zoom((double)span_center, (double)span);
+        }
+    }
 
     // FIXME: fftsize is a reference
-    rx->get_iq_fft_data(d_fftData, fftsize);
+    rx->get_iq_fft_data(d_realFftData, d_iirFftData, fftsize, center, bandwidth);
 
     if (fftsize == 0)
     {
@@ -1278,48 +1430,33 @@ void MainWindow::iqFftTimeout()
         return;
     }
 
-    // NB: without cast to float the multiplication will overflow at 64k
-    // and pwr_scale will be inf
-    pwr_scale = 1.0 / ((float)fftsize * (float)fftsize);
-
-    /* Normalize, calculate power and shift the FFT */
-    for (i = 0; i < fftsize; i++)
-    {
-
-        /* normalize and shift */
-        if (i < fftsize/2)
-        {
-            pt = d_fftData[fftsize/2+i];
-        }
-        else
-        {
-            pt = d_fftData[i-fftsize/2];
-        }
+    ui->plotter->setFftDataRange((qint64)center, (float)bandwidth);
+    ui->plotter->setNewFftData(d_iirFftData, d_realFftData, fftsize);
+    remote->setSpectrum(d_iirFftData, fftsize, d_lnb_lo + d_hw_freq + (qint64)center,
+                        (float)bandwidth);
 
-        /* calculate power in dBFS */
-        pwr = pwr_scale * (pt.imag() * pt.imag() + pt.real() * pt.real());
-        d_realFftData[i] = 10.0 * log10f(pwr + 1.0e-20);
+    if (!d_tracking)
+        return;
 
-        /* FFT averaging */
-        d_iirFftData[i] += d_fftAvg * (d_realFftData[i] - d_iirFftData[i]);
-    }
+    // signals are tracked in the FFT block relative to the hardware frequency
+    rx->get_iq_fft_signals(d_signals);
+    for (size_t i = 0; i < d_signals.size(); i++)
+        d_signals[i].frequency += (double)(d_lnb_lo + d_hw_freq);
 
-    ui->plotter->setNewFftData(d_iirFftData, d_realFftData, fftsize);
+    ui->plotter->setSignals(d_signals);
+    remote->setSignals(d_signals);
+    uiDockBookmarks->actionAddDetected->setEnabled(!d_signals.empty());
 }
 
 /** Audio FFT plot timeout. */
 void MainWindow::audioFftTimeout()
 {
     unsigned int    fftsize;
-    unsigned int    i;
-    float           pwr;
-    float           pwr_scale;
-    std::complex<float> pt;             /* a single FFT point used in calculations */
 
     if (!d_have_audio || !uiDockAudio->isVisible())
         return;
 
-    rx->get_audio_fft_data(d_fftData, fftsize);
+    rx->get_audio_fft_data(d_realFftData, fftsize);
 
     if (fftsize == 0)
     {
@@ -1328,27 +1465,6 @@ void MainWindow::audioFftTimeout()
         return;
     }
 
-    pwr_scale = 1.0 / (fftsize * fftsize);
-
-    /** FIXME: move post processing to rx_fft_f **/
-    /* Normalize, calculcate power and shift the FFT */
-    for (i = 0; i < fftsize; i++)
-    {
-        /* normalize and shift */
-        if (i < fftsize/2)
-        {
-            pt = d_fftData[fftsize/2+i];
-        }
-        else
-        {
-            pt = d_fftData[i-fftsize/2];
-        }
-
-        /* calculate power in dBFS */
-        pwr = pwr_scale * (pt.imag() * pt.imag() + pt.real() * pt.real());
-        d_realFftData[i] = 10.0 * log10f(pwr + 1.0e-20);
-    }
-
     uiDockAudio->setNewFftData(d_realFftData, fftsize);
 }
 
@@ -1516,6 +1632,7 @@ void MainWindow::startIqPlayback(const QString filename, float samprate)
 
     qDebug() << __func__ << ":" << devstr;
 
+    cancelScan("DEVICE");
     rx->set_input_device(devstr.toStdString());
 
     // sample rate
@@ -1551,6 +1668,7 @@ void MainWindow::stopIqPlayback()
 
     // restore original input device
     QString indev = m_settings->value("input/device", "").toString();
+    cancelScan("DEVICE");
     rx->set_input_device(indev.toStdString());
 
     // restore sample rate
@@ -1597,8 +1715,6 @@ void MainWindow::setIqFftSize(int size)
 {
     qDebug() << "Changing baseband FFT size to" << size;
     rx->set_iq_fft_size(size);
-    for (int i = 0; i < size; i++)
-        d_iirFftData[i] = -140.0;  // dBFS
 }
 
 /** Baseband FFT rate has changed. */
@@ -1623,7 +1739,10 @@ void MainWindow::setIqFftRate(int fps)
     if (interval > 9 && iq_fft_timer->isActive())
         iq_fft_timer->setInterval(interval);
 
-    uiDockFft->setWfResolution(ui->plotter->getWfTimeRes());
+    rx->set_iq_fft_rate(fps);
+
+    uiDockFft->setWfResolution(ui->plotter->getWfTimeRes(),
+                               ui->plotter->getWfHistoryLines());
 }
 
 void MainWindow::setIqFftWindow(int type)
@@ -1636,12 +1755,43 @@ void MainWindow::setWfTimeSpan(quint64 span_ms)
 {
     // set new time span, then send back new resolution to be shown by GUI label
     ui->plotter->setWaterfallSpan(span_ms);
-    uiDockFft->setWfResolution(ui->plotter->getWfTimeRes());
+    uiDockFft->setWfResolution(ui->plotter->getWfTimeRes(),
+                               ui->plotter->getWfHistoryLines());
+}
+
+/**
+ * @brief Waterfall history size has changed.
+ * @param size_mb The size of the history file in MB, 0 disables it.
+ *
+ * The file is waterfall.dat in the configuration directory unless
+ * waterfall/history_file is set. It is cleared whenever it is opened.
+ */
+void MainWindow::setWfHistorySize(int size_mb)
+{
+    if (size_mb == d_wf_history_mb)
+        return;
+
+    d_wf_history_mb = size_mb;
+
+    QString hist_file = QString("%1/waterfall.dat").arg(m_cfg_dir);
+    if (m_settings)
+        hist_file = m_settings->value("waterfall/history_file", hist_file).toString();
+
+    if (ui->plotter->setWaterfallHistory(hist_file, (qint64)size_mb << 20))
+    {
+        int lines = ui->plotter->getWfHistoryLines();
+
+        qDebug() << "Waterfall history:" << hist_file << lines << "lines,"
+                 << lines * ui->plotter->getWfTimeRes() / 1000 << "s";
+    }
+    uiDockFft->setWfResolution(ui->plotter->getWfTimeRes(),
+                               ui->plotter->getWfHistoryLines());
 }
 
 void MainWindow::setWfSize()
 {
-    uiDockFft->setWfResolution(ui->plotter->getWfTimeRes());
+    uiDockFft->setWfResolution(ui->plotter->getWfTimeRes(),
+                               ui->plotter->getWfHistoryLines());
 }
 
 /**
@@ -1657,7 +1807,42 @@ void MainWindow::setIqFftSplit(int pct_wf)
 void MainWindow::setIqFftAvg(float avg)
 {
     if ((avg >= 0) && (avg <= 1.0))
-        d_fftAvg = avg;
+        rx->set_iq_fft_avg(avg);
+}
+
+/**
+ * @brief Welch averaging of the baseband FFT changed.
+ * @param segments The number of segments per frame (< 2 disables Welch).
+ * @param overlap The overlap between segments (0.0 to 0.9).
+ */
+void MainWindow::setIqFftWelch(int segments, float overlap)
+{
+    rx->set_iq_fft_welch(segments, overlap);
+}
+
+/**
+ * @brief Number of baseband FFT threads changed.
+ * @param threads The number of FFTW threads.
+ * @param min_size Smaller FFTs are computed in a single thread.
+ */
+void MainWindow::setIqFftThreads(int threads, int min_size)
+{
+    rx->set_iq_fft_threads(threads, min_size);
+}
+
+/**
+ * @brief Zoom FFT mode toggled.
+ * @param enabled Whether the baseband FFT follows the zoomed span.
+ *
+ * The span itself is sent to the receiver from iqFftTimeout().
+ */
+void MainWindow::setIqFftZoomMode(bool enabled)
+{
+    d_fftZoom = enabled;
+    d_fftZoomCenter = 0;
+    d_fftZoomSpan = 0;
+    if (!enabled)
+        rx->set_iq_fft_zoom(0.0, 0.0);
 }
 
 /** Audio FFT rate has changed. */
@@ -1693,7 +1878,34 @@ void MainWindow::setFftPeakHold(bool enable)
 
 void MainWindow::setPeakDetection(bool enabled)
 {
-    ui->plotter->setPeakDetection(enabled ,2);
+    ui->plotter->setPeakDetection(enabled);
+    d_peakDetection = enabled;
+    updateTracking();
+}
+
+/**
+ * @brief Run the signal tracker only while its signals are used.
+ *
+ * The signals are used by peak detection, by remote clients that sent
+ * SIGNALS and by the "add detected" action of the bookmarks dock.
+ */
+void MainWindow::updateTracking()
+{
+    bool enabled = d_peakDetection || remote->hasSignalClients() ||
+                   uiDockBookmarks->isVisible();
+
+    if (enabled == d_tracking)
+        return;
+
+    d_tracking = enabled;
+    rx->set_iq_fft_tracking(enabled);
+
+    if (!enabled)
+    {
+        d_signals.clear();
+        remote->setSignals(d_signals);
+        uiDockBookmarks->actionAddDetected->setEnabled(false);
+    }
 }
 
 /**
@@ -1734,6 +1946,8 @@ void MainWindow::on_actionDSP_triggered(bool checked)
         /* start GUI timers */
         meter_timer->start(100);
 
+        rx->set_iq_fft_rate(uiDockFft->fftRate());
+
         if (uiDockFft->fftRate())
         {
             iq_fft_timer->start(1000/uiDockFft->fftRate());
@@ -1763,6 +1977,7 @@ void MainWindow::on_actionDSP_triggered(bool checked)
         rds_timer->stop();
 
         /* stop receiver */
+        cancelScan("DSP");
         rx->stop();
 
         /* update menu text and button tooltip */
@@ -1905,6 +2120,43 @@ void MainWindow::on_actionSaveWaterfall_triggered()
     m_settings->setValue("wf_save_dir", fi.absolutePath());
 }
 
+/** Start/stop writing the waterfall to disk. */
+void MainWindow::on_actionLogWaterfall_triggered(bool checked)
+{
+    if (!checked)
+    {
+        quint64 dropped = ui->plotter->stopWaterfallLog();
+
+        if (dropped > 0)
+            ui->statusBar->showMessage(tr("Waterfall log stopped, %1 lines "
+                                          "dropped (see index.csv)")
+                                       .arg(dropped));
+        else
+            ui->statusBar->showMessage(tr("Waterfall log stopped"), 5000);
+        return;
+    }
+
+    QString log_dir = QFileDialog::getExistingDirectory(this,
+                                    tr("Waterfall log directory"),
+                                    m_settings->value("wf_log_dir", "").toString());
+    if (log_dir.isEmpty())
+    {
+        ui->actionLogWaterfall->setChecked(false);
+        return;
+    }
+
+    if (!ui->plotter->startWaterfallLog(log_dir))
+    {
+        ui->actionLogWaterfall->setChecked(false);
+        QMessageBox::critical(this,
+                              tr("Error"),
+                              tr("There was an error starting the waterfall log"));
+        return;
+    }
+
+    m_settings->setValue("wf_log_dir", log_dir);
+}
+
 /** Show I/Q player. */
 void MainWindow::on_actionIqTool_triggered()
 {
@@ -1944,6 +2196,7 @@ void MainWindow::on_plotter_newFilterFreq(int low, int high)
 
 void MainWindow::on_plotter_newCenterFreq(qint64 f)
 {
+    cancelScan("TUNE");
     rx->set_rf_freq(f);
     ui->freqCtrl->setFrequency(f);
 }
@@ -2322,7 +2575,39 @@ void MainWindow::on_actionAddBookmark_triggered()
 
         Bookmarks::Get().add(info);
         uiDockBookmarks->updateTags();
-        uiDockBookmarks->updateBookmarks();
+        ui->plotter->updateOverlay();
+    }
+}
+
+/** Add a bookmark for each detected signal that is not bookmarked yet. */
+void MainWindow::addDetectedBookmarks()
+{
+    TagInfo    &tag = Bookmarks::Get().findOrAddTag(tr("Detected"));
+    int         added = 0;
+
+    for (size_t i = 0; i < d_signals.size(); i++)
+    {
+        const tracked_signal &sig = d_signals[i];
+        qint64  freq = llround(sig.frequency);
+        qint64  bw = qMax((qint64)llround(sig.bandwidth), (qint64)1);
+
+        if (Bookmarks::Get().upperBound(freq + bw / 2) >
+            Bookmarks::Get().lowerBound(freq - bw / 2))
+            continue;
+
+        BookmarkInfo info;
+        info.frequency = freq;
+        info.bandwidth = bw;
+        info.modulation = uiDockRxOpt->currentDemodAsString();
+        info.name = tr("Signal %1 dB").arg(sig.snr, 0, 'f', 0);
+        info.tags.append(&tag);
+        Bookmarks::Get().add(info);
+        added++;
+    }
+
+    if (added > 0)
+    {
+        uiDockBookmarks->updateTags();
         ui->plotter->updateOverlay();
     }
 }
@@ -43,6 +43,7 @@
 #include "qtgui/iq_tool.h"
 
 #include "applications/gqrx/remote_control.h"
+#include "dsp/signal_tracker.h"
 
 // see https://bugreports.qt-project.org/browse/QTBUG-22829
 #ifndef Q_MOC_RUN
@@ -83,10 +84,16 @@ private:
     qint64 d_hw_freq_stop;
 
     enum receiver::filter_shape d_filter_shape;
-    std::complex<float>* d_fftData;
     float          *d_realFftData;
     float          *d_iirFftData;
-    float           d_fftAvg;      /*!< FFT averaging parameter set by user (not the true gain). */
+    bool            d_fftZoom;       /*!< Zoom FFT enabled. */
+    qint64          d_fftZoomCenter; /*!< Last span sent to the zoom FFT. */
+    qint64          d_fftZoomSpan;
+    bool            d_peakDetection; /*!< Peak detection enabled on the plotter. */
+    bool            d_tracking;      /*!< Signal tracker enabled in the I/Q FFT. */
+    std::vector<tracked_signal> d_signals;  /*!< Signals found in the I/Q FFT. */
+    std::vector<receiver::scan_event> d_scan_events; /*!< Events read from the scanner. */
+    int             d_wf_history_mb; /*!< Size of the waterfall history, -1 before it is set. */
 
     bool d_have_audio;  /*!< Whether we have audio (i.e. not with demod_off. */
 
@@ -124,6 +131,8 @@ private:
     void updateHWFrequencyRange(bool ignore_limits);
     void updateFrequencyRange();
     void updateGainStages(bool read_from_device);
+    void cancelScan(const QString &reason);
+    void readScanEvents();
     void showSimpleTextFile(const QString &resource_path,
                             const QString &window_title);
 
@@ -134,6 +143,9 @@ private slots:
 
     /* baseband receiver */
     void setFilterOffset(qint64 freq_hz);
+    void hwSettingApplied(int setting, QString name, double value);
+    void startScan(QList<qint64> freqs, int dwell_ms, double threshold, int hold_ms);
+    void stopScan();
     void setGain(QString name, double gain);
     void setAutoGain(bool enabled);
     void setFreqCorr(double ppm);
@@ -182,12 +194,17 @@ private slots:
     void setIqFftWindow(int type);
     void setIqFftSplit(int pct_wf);
     void setIqFftAvg(float avg);
+    void setIqFftWelch(int segments, float overlap);
+    void setIqFftThreads(int threads, int min_size);
+    void setIqFftZoomMode(bool enabled);
     void setAudioFftRate(int fps);
     void setFftColor(const QColor color);
     void setFftFill(bool enable);
     void setPeakDetection(bool enabled);
+    void updateTracking();
     void setFftPeakHold(bool enable);
     void setWfTimeSpan(quint64 span_ms);
+    void setWfHistorySize(int size_mb);
     void setWfSize();
 
     /* FFT plot */
@@ -207,6 +224,8 @@ private slots:
     void on_actionLoadSettings_triggered();
     void on_actionSaveSettings_triggered();
     void on_actionSaveWaterfall_triggered();
+    void on_actionLogWaterfall_triggered(bool checked);
+    void addDetectedBookmarks();
     void on_actionIqTool_triggered();
     void on_actionFullScreen_triggered(bool checked);
     void on_actionRemoteControl_triggered(bool checked);
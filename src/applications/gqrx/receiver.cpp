@@ -20,6 +20,7 @@
  * the Free Software Foundation, Inc., 51 Franklin Street,
  * Boston, MA 02110-1301, USA.
  */
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #ifndef _MSC_VER
@@ -50,6 +51,8 @@
 #endif
 
 #define DEFAULT_AUDIO_GAIN -6.0
+#define SCAN_POLL_MS        10      /* level check interval while holding */
+#define SCAN_MAX_EVENTS     256     /* events kept until the GUI reads them */
 
 /**
  * @brief Public contructor.
@@ -73,7 +76,19 @@ receiver::receiver(const std::string input_device,
       d_iq_rev(false),
       d_dc_cancel(false),
       d_iq_balance(false),
-      d_demod(RX_DEMOD_OFF)
+      d_demod(RX_DEMOD_OFF),
+      d_hw_quit(false),
+      d_hw_busy(false),
+      d_hw_pending(0),
+      d_pending_freq_corr(0.0),
+      d_pending_bandwidth(0.0),
+      d_pending_auto_gain(false),
+      d_tuned_freq(0.0),
+      d_scan_stop(false),
+      d_scan_dwell(0),
+      d_scan_threshold(0.f),
+      d_scan_hold(0),
+      d_scan_offset(0.0)
 {
 
     tb = gr::make_top_block("gqrx");
@@ -142,6 +157,8 @@ receiver::receiver(const std::string input_device,
 
     set_demod(RX_DEMOD_NFM);
 
+    d_hw_thread = boost::thread(&receiver::hw_thread, this);
+
 #ifndef QT_NO_DEBUG_OUTPUT
     gr::prefs pref;
     std::cout << "Using audio backend: "
@@ -152,6 +169,15 @@ receiver::receiver(const std::string input_device,
 
 receiver::~receiver()
 {
+    stop_scan();
+
+    {
+        boost::mutex::scoped_lock lock(d_hw_mutex);
+        d_hw_quit = true;
+    }
+    d_hw_cond.notify_all();
+    d_hw_thread.join();
+
     tb->stop();
 }
 
@@ -169,6 +195,8 @@ void receiver::start()
 /** Stop the receiver. */
 void receiver::stop()
 {
+    stop_scan();
+
     if (d_running)
     {
         tb->stop();
@@ -203,6 +231,12 @@ void receiver::set_input_device(const std::string device)
 
     input_devstr = device;
 
+    // the scanner would keep tuning the old device
+    stop_scan();
+
+    // settings for the old device must not end up on the new one
+    wait_hw();
+
     // tb->lock() can hang occasionally
     if (d_running)
     {
@@ -220,20 +254,29 @@ void receiver::set_input_device(const std::string device)
         tb->disconnect(src, 0, iq_swap, 0);
     }
 
-    src.reset();
+    double  src_rate;
 
-    try
     {
-        src = osmosdr::source::make(device);
-    }
-    catch (std::runtime_error &x)
-    {
-        error = x.what();
-        src = osmosdr::source::make("file="+get_random_file()+",freq=428e6,rate=96000,repeat=true,throttle=true");
+        boost::mutex::scoped_lock lock(d_src_mutex);
+
+        src.reset();
+
+        try
+        {
+            src = osmosdr::source::make(device);
+        }
+        catch (std::runtime_error &x)
+        {
+            error = x.what();
+            src = osmosdr::source::make("file="+get_random_file()+",freq=428e6,rate=96000,repeat=true,throttle=true");
+        }
+
+        src_rate = src->get_sample_rate();
     }
 
-    if(src->get_sample_rate() != 0)
-        set_input_rate(src->get_sample_rate());
+    // set_input_rate() takes d_src_mutex itself
+    if (src_rate != 0)
+        set_input_rate(src_rate);
 
     if (d_decim >= 2)
     {
@@ -302,18 +345,141 @@ void receiver::set_output_device(const std::string device)
     tb->unlock();
 }
 
+/**
+ * @brief Set the function called when a hardware setting has been applied.
+ *
+ * The callback is called in the control thread and must not call back
+ * into the receiver.
+ */
+void receiver::set_hw_callback(hw_callback callback)
+{
+    boost::mutex::scoped_lock lock(d_hw_mutex);
+    d_hw_callback = callback;
+}
+
+/** Wait until all queued hardware settings have been applied. */
+void receiver::wait_hw(void)
+{
+    boost::mutex::scoped_lock lock(d_hw_mutex);
+
+    while (d_hw_pending != 0 || d_hw_busy)
+        d_hw_cond.wait(lock);
+}
+
+/** Wake the control thread for a new setting (d_hw_mutex held). */
+void receiver::queue_hw(unsigned int setting)
+{
+    d_hw_pending |= setting;
+    d_hw_cond.notify_all();
+}
+
+/**
+ * @brief The control thread applying the hardware settings.
+ *
+ * Only the latest value of each setting is kept while the device is busy,
+ * so a burst of changes, e.g. when dragging a slider, results in at most
+ * one more call into the device per setting. The settings taken together
+ * are applied in a fixed order with the frequency last.
+ */
+void receiver::hw_thread()
+{
+    boost::mutex::scoped_lock lock(d_hw_mutex);
+
+    for (;;)
+    {
+        while (d_hw_pending == 0 && !d_hw_quit)
+            d_hw_cond.wait(lock);
+
+        if (d_hw_quit)
+            return;
+
+        unsigned int    pending = d_hw_pending;
+        double          requested = d_rf_freq;
+        double          freq = requested;
+        double          freq_corr = d_pending_freq_corr;
+        double          bandwidth = d_pending_bandwidth;
+        bool            auto_gain = d_pending_auto_gain;
+        std::string     antenna = d_pending_antenna;
+        std::map<std::string, double> gains;
+        hw_callback     callback = d_hw_callback;
+
+        gains.swap(d_pending_gains);
+        d_hw_pending = 0;
+        d_hw_busy = true;
+        lock.unlock();
+
+        {
+            boost::mutex::scoped_lock src_lock(d_src_mutex);
+
+            if (pending & HW_ANTENNA)
+            {
+                src->set_antenna(antenna);
+                if (callback)
+                    callback(HW_ANTENNA, antenna, 0.0);
+            }
+            if (pending & HW_BANDWIDTH)
+            {
+                bandwidth = src->set_bandwidth(bandwidth);
+                if (callback)
+                    callback(HW_BANDWIDTH, "", bandwidth);
+            }
+            if (pending & HW_FREQ_CORR)
+            {
+                freq_corr = src->set_freq_corr(freq_corr);
+                if (callback)
+                    callback(HW_FREQ_CORR, "", freq_corr);
+            }
+            if (pending & HW_AUTO_GAIN)
+            {
+                auto_gain = src->set_gain_mode(auto_gain);
+                if (callback)
+                    callback(HW_AUTO_GAIN, "", auto_gain ? 1.0 : 0.0);
+            }
+            if (pending & HW_GAIN)
+            {
+                std::map<std::string, double>::const_iterator it;
+                for (it = gains.begin(); it != gains.end(); ++it)
+                {
+                    double gain = src->set_gain(it->second, it->first);
+                    if (callback)
+                        callback(HW_GAIN, it->first, gain);
+                }
+            }
+            if (pending & HW_FREQ)
+            {
+                freq = src->set_center_freq(freq);
+                if (freq != d_tuned_freq)
+                    iq_fft->retune();
+                d_tuned_freq = freq;
+                if (callback)
+                    callback(HW_FREQ, "", freq);
+            }
+        }
+
+        lock.lock();
+        // report what the device has been tuned to unless retuned meanwhile
+        if ((pending & HW_FREQ) && d_rf_freq == requested)
+            d_rf_freq = freq;
+        d_hw_busy = false;
+        d_hw_cond.notify_all();
+    }
+}
+
 /** Get a list of available antenna connectors. */
 std::vector<std::string> receiver::get_antennas(void) const
 {
+    boost::mutex::scoped_lock lock(d_src_mutex);
     return src->get_antennas();
 }
 
-/** Select antenna conenctor. */
+/** Select antenna conenctor. The antenna is set in the control thread. */
 void receiver::set_antenna(const std::string &antenna)
 {
     if (!antenna.empty())
     {
-        src->set_antenna(antenna);
+        boost::mutex::scoped_lock lock(d_hw_mutex);
+        d_pending_antenna = antenna;
+        queue_hw(HW_ANTENNA);
     }
 }
 
@@ -328,6 +494,8 @@ double receiver::set_input_rate(double rate)
     double  current_rate;
     bool    rate_has_changed;
 
+    boost::mutex::scoped_lock src_lock(d_src_mutex);
+
     current_rate = src->get_sample_rate();
     rate_has_changed = !(rate == current_rate ||
             std::abs(rate - current_rate) < std::abs(std::min(rate, current_rate))
@@ -424,7 +592,10 @@ unsigned int receiver::set_input_decim(unsigned int decim)
 
 #ifdef CUSTOM_AIRSPY_KERNELS
     if (input_devstr.find("airspy") != std::string::npos)
+    {
+        boost::mutex::scoped_lock lock(d_src_mutex);
         src->set_bandwidth(d_quad_rate);
+    }
 #endif
 
     if (d_running)
@@ -436,16 +607,30 @@ unsigned int receiver::set_input_decim(unsigned int decim)
 /**
  * @brief Set new analog bandwidth.
  * @param bw The new bandwidth.
- * @return The actual bandwidth.
+ * @return The requested bandwidth.
+ *
+ * The bandwidth is set in the control thread, the actual bandwidth is
+ * passed to the hw_callback.
  */
 double receiver::set_analog_bandwidth(double bw)
 {
-    return src->set_bandwidth(bw);
+    boost::mutex::scoped_lock lock(d_hw_mutex);
+    d_pending_bandwidth = bw;
+    queue_hw(HW_BANDWIDTH);
+
+    return bw;
 }
 
 /** Get current analog bandwidth. */
 double receiver::get_analog_bandwidth(void) const
 {
+    {
+        boost::mutex::scoped_lock lock(d_hw_mutex);
+        if (d_hw_pending & HW_BANDWIDTH)
+            return d_pending_bandwidth;
+    }
+
+    boost::mutex::scoped_lock lock(d_src_mutex);
     return src->get_bandwidth();
 }
 
@@ -508,6 +693,7 @@ void receiver::set_iq_balance(bool enable)
 
     d_iq_balance = enable;
 
+    boost::mutex::scoped_lock lock(d_src_mutex);
     src->set_iq_balance_mode(enable ? 2 : 0);
 }
 
@@ -526,29 +712,51 @@ bool receiver::get_iq_balance(void) const
  * @param freq_hz The desired frequency in Hz.
  * @return RX_STATUS_ERROR if an error occurs, e.g. the frequency is out of range.
  * @sa get_rf_freq()
+ *
+ * The device is tuned in the control thread, this function does not block.
+ * A running scan is stopped, see start_scan().
  */
 receiver::status receiver::set_rf_freq(double freq_hz)
 {
-    d_rf_freq = freq_hz;
+    stop_scan();
 
-    src->set_center_freq(d_rf_freq);
-    // FIXME: read back frequency?
+    boost::mutex::scoped_lock lock(d_hw_mutex);
+    d_rf_freq = freq_hz;
+    queue_hw(HW_FREQ);
 
     return STATUS_OK;
 }
 
 /**
  * @brief Get RF frequency.
- * @return The current RF frequency.
+ * @return The requested RF frequency, or the one reported by the device
+ *         once it has been tuned.
  * @sa set_rf_freq()
  */
 double receiver::get_rf_freq(void)
 {
-    d_rf_freq = src->get_center_freq();
-
+    boost::mutex::scoped_lock lock(d_hw_mutex);
     return d_rf_freq;
 }
 
+/**
+ * @brief Tune the device right away, used by the scanner.
+ *
+ * A frequency still queued for the control thread is dropped.
+ */
+void receiver::tune_now(double freq_hz)
+{
+    {
+        boost::mutex::scoped_lock lock(d_hw_mutex);
+        d_hw_pending &= ~HW_FREQ;
+        d_rf_freq = freq_hz;
+    }
+
+    boost::mutex::scoped_lock lock(d_src_mutex);
+    d_tuned_freq = src->set_center_freq(freq_hz);
+    iq_fft->retune();
+}
+
 /**
  * @brief Get the RF frequency range of the current input device.
  * @param start The lower limit of the range in Hz.
@@ -560,6 +768,7 @@ receiver::status receiver::get_rf_range(double *start, double *stop, double *ste
 {
     osmosdr::freq_range_t range;
 
+    boost::mutex::scoped_lock lock(d_src_mutex);
     range = src->get_freq_range();
 
     // currently range is empty for all but E4000
@@ -581,6 +790,7 @@ receiver::status receiver::get_rf_range(double *start, double *stop, double *ste
 /** Get the names of available gain stages. */
 std::vector<std::string> receiver::get_gain_names()
 {
+    boost::mutex::scoped_lock lock(d_src_mutex);
     return src->get_gain_names();
 }
 
@@ -598,6 +808,7 @@ receiver::status receiver::get_gain_range(std::string &name, double *start,
 {
     osmosdr::gain_range_t range;
 
+    boost::mutex::scoped_lock lock(d_src_mutex);
     range = src->get_gain_range(name);
     *start = range.start();
     *stop  = range.stop();
@@ -606,15 +817,26 @@ receiver::status receiver::get_gain_range(std::string &name, double *start,
     return STATUS_OK;
 }
 
+/** Set the gain of a gain stage. The gain is set in the control thread. */
 receiver::status receiver::set_gain(std::string name, double value)
 {
-    src->set_gain(value, name);
+    boost::mutex::scoped_lock lock(d_hw_mutex);
+    d_pending_gains[name] = value;
+    queue_hw(HW_GAIN);
 
     return STATUS_OK;
 }
 
 double receiver::get_gain(std::string name) const
 {
+    {
+        boost::mutex::scoped_lock lock(d_hw_mutex);
+        std::map<std::string, double>::const_iterator it = d_pending_gains.find(name);
+        if (it != d_pending_gains.end())
+            return it->second;
+    }
+
+    boost::mutex::scoped_lock lock(d_src_mutex);
     return src->get_gain(name);
 }
 
@@ -626,7 +848,9 @@ double receiver::get_gain(std::string name) const
  */
 receiver::status receiver::set_auto_gain(bool automatic)
 {
-    src->set_gain_mode(automatic);
+    boost::mutex::scoped_lock lock(d_hw_mutex);
+    d_pending_auto_gain = automatic;
+    queue_hw(HW_AUTO_GAIN);
 
     return STATUS_OK;
 }
@@ -707,9 +931,12 @@ receiver::status receiver::set_filter(double low, double high, filter_shape shap
     return STATUS_OK;
 }
 
+/** Set frequency correction in ppm. The correction is set in the control thread. */
 receiver::status receiver::set_freq_corr(double ppm)
 {
-    src->set_freq_corr(ppm);
+    boost::mutex::scoped_lock lock(d_hw_mutex);
+    d_pending_freq_corr = ppm;
+    queue_hw(HW_FREQ_CORR);
 
     return STATUS_OK;
 }
@@ -738,14 +965,64 @@ void receiver::set_iq_fft_window(int window_type)
     iq_fft->set_window_type(window_type);
 }
 
-/** Get latest baseband FFT data. */
-void receiver::get_iq_fft_data(std::complex<float>* fftPoints, unsigned int &fftsize)
+/** Set the rate at which baseband FFT frames are captured. */
+void receiver::set_iq_fft_rate(int fps)
 {
-    iq_fft->get_fft_data(fftPoints, fftsize);
+    iq_fft->set_fft_rate(fps);
 }
 
-/** Get latest audio FFT data. */
-void receiver::get_audio_fft_data(std::complex<float>* fftPoints, unsigned int &fftsize)
+/** Set number of averaged segments and overlap of the baseband Welch PSD. */
+void receiver::set_iq_fft_welch(int segments, float overlap)
+{
+    iq_fft->set_welch(segments, overlap);
+}
+
+/** Set number of threads used for baseband FFTs with at least min_size points. */
+void receiver::set_iq_fft_threads(int nthreads, unsigned int min_size)
+{
+    iq_fft->set_fft_threads(nthreads, min_size);
+}
+
+/** Set gain of the baseband FFT averaging filter. */
+void receiver::set_iq_fft_avg(float gain)
+{
+    iq_fft->set_averaging(gain);
+}
+
+/**
+ * @brief Set the span shown by the GUI for the zoom FFT.
+ * @param center The center of the span relative to the RF center frequency.
+ * @param span The width of the span. 0 computes the full band.
+ */
+void receiver::set_iq_fft_zoom(double center, double span)
+{
+    iq_fft->set_zoom(center, span);
+}
+
+/** Get latest baseband FFT data (dBFS) and the band it covers. */
+void receiver::get_iq_fft_data(float* fftPoints, float* avgPoints, unsigned int &fftsize,
+                               double &center, double &bandwidth)
+{
+    iq_fft->get_fft_data(fftPoints, avgPoints, fftsize, center, bandwidth);
+}
+
+/** Enable or disable the signal tracker of the baseband FFT. */
+void receiver::set_iq_fft_tracking(bool enabled)
+{
+    iq_fft->set_tracking(enabled);
+}
+
+/**
+ * @brief Get the signals found in the baseband FFT.
+ * @param sigs The signals, frequencies relative to the RF center frequency.
+ */
+void receiver::get_iq_fft_signals(std::vector<tracked_signal> &sigs)
+{
+    iq_fft->get_signals(sigs);
+}
+
+/** Get latest audio FFT data (dBFS). */
+void receiver::get_audio_fft_data(float* fftPoints, unsigned int &fftsize)
 {
     audio_fft->get_fft_data(fftPoints, fftsize);
 }
@@ -1202,6 +1479,7 @@ receiver::status receiver::stop_iq_recording()
 receiver::status receiver::seek_iq_file(long pos)
 {
     receiver::status status = STATUS_OK;
+    boost::mutex::scoped_lock lock(d_src_mutex);
 
     tb->lock();
 
@@ -1360,6 +1638,146 @@ void receiver::update_ddc()
     rot->set_phase_inc(2.0 * M_PI * (-d_filter_offset + d_cw_offset) / d_quad_rate);
 }
 
+/**
+ * @brief Start scanning a list of frequencies.
+ * @param freqs The receive frequencies (RF + filter offset) in Hz.
+ * @param dwell_ms Time to wait after tuning before the level is measured.
+ * @param threshold_db Signal level in dBFS that stops the scanner.
+ * @param hold_ms Time to stay on a frequency after the signal has faded.
+ *
+ * The scanner runs in its own thread and tunes the hardware directly,
+ * bypassing the control thread, so the scan rate is limited by the retune
+ * time of the device and the dwell time. The dwell time must cover the time
+ * it takes until the signal level reflects the new frequency.
+ *
+ * Hits are queued and read with get_scan_events(). A scan that is already
+ * running is stopped first. The scan is also stopped by set_rf_freq(),
+ * stop() and set_input_device(); the filter offset is taken at the start.
+ * The receiver must be running.
+ */
+receiver::status receiver::start_scan(const std::vector<double> &freqs,
+                                      int dwell_ms, float threshold_db,
+                                      int hold_ms)
+{
+    stop_scan();
+
+    if (freqs.empty() || !d_running)
+        return STATUS_ERROR;
+
+    d_scan_freqs = freqs;
+    d_scan_offset = d_filter_offset;
+    d_scan_dwell = std::max(dwell_ms, 1);
+    d_scan_threshold = threshold_db;
+    d_scan_hold = std::max(hold_ms, 0);
+    d_scan_stop = false;
+    d_scan_events.clear();
+
+    d_scan_thread = boost::thread(&receiver::scan_thread, this);
+
+    return STATUS_OK;
+}
+
+/** Stop the scanner and leave the receiver on the current frequency. */
+void receiver::stop_scan()
+{
+    if (!d_scan_thread.joinable())
+        return;
+
+    {
+        boost::mutex::scoped_lock lock(d_scan_mutex);
+        d_scan_stop = true;
+    }
+    d_scan_cond.notify_all();
+    d_scan_thread.join();
+}
+
+/** Get the scanner events since the last call. */
+void receiver::get_scan_events(std::vector<scan_event> &events)
+{
+    boost::mutex::scoped_lock lock(d_scan_mutex);
+
+    events.swap(d_scan_events);
+    d_scan_events.clear();
+}
+
+/**
+ * @brief The scan loop, runs in d_scan_thread.
+ *
+ * The scan parameters are only changed while the thread is not running.
+ */
+void receiver::scan_thread()
+{
+    size_t  i = 0;
+
+    for (;;)
+    {
+        double freq = d_scan_freqs[i];
+
+        tune_now(freq - d_scan_offset);
+
+        if (scan_wait(d_scan_dwell))
+            return;
+
+        float level = get_signal_pwr(true);
+        if (level >= d_scan_threshold)
+        {
+            float   peak = level;
+            int     quiet = 0;
+
+            add_scan_event(freq, level, true);
+
+            // stay while the signal is present and hold_ms after it is gone
+            while (quiet < d_scan_hold)
+            {
+                if (scan_wait(SCAN_POLL_MS))
+                    return;
+
+                level = get_signal_pwr(true);
+                if (level >= d_scan_threshold)
+                {
+                    peak = std::max(peak, level);
+                    quiet = 0;
+                }
+                else
+                {
+                    quiet += SCAN_POLL_MS;
+                }
+            }
+
+            add_scan_event(freq, peak, false);
+        }
+
+        i = (i + 1) % d_scan_freqs.size();
+    }
+}
+
+/**
+ * @brief Wait in the scanner thread.
+ * @param ms The time to wait in milliseconds.
+ * @return True if the scanner has been stopped.
+ */
+bool receiver::scan_wait(int ms)
+{
+    boost::mutex::scoped_lock lock(d_scan_mutex);
+
+    d_scan_cond.timed_wait(lock, boost::posix_time::milliseconds(ms),
+                           [this] { return d_scan_stop; });
+
+    return d_scan_stop;
+}
+
+/** Queue a scanner event for the GUI (scanner thread). */
+void receiver::add_scan_event(double freq, float level, bool found)
+{
+    boost::mutex::scoped_lock lock(d_scan_mutex);
+
+    if (d_scan_events.size() < SCAN_MAX_EVENTS)
+    {
+        scan_event event = { freq, level, found };
+        d_scan_events.push_back(event);
+    }
+}
+
 void receiver::get_rds_data(std::string &outbuff, int &num)
 {
     rx->get_rds_data(outbuff, num);
@@ -36,7 +36,13 @@
 #include <gnuradio/blocks/wavfile_source.h>
 #include <gnuradio/top_block.h>
 #include <osmosdr/source.h>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <functional>
+#include <map>
 #include <string>
+#include <vector>
 
 #include "dsp/correct_iq_cc.h"
 #include "dsp/filter/fir_decim.h"
@@ -109,6 +115,31 @@ public:
         FILTER_SHAPE_SHARP = 2   /*!< Sharp: Transition band is TBD of width. */
     };
 
+    /** Hardware settings applied by the control thread. */
+    enum hw_setting {
+        HW_FREQ      = 0x01,  /*!< RF frequency. */
+        HW_GAIN      = 0x02,  /*!< Gain of a named gain stage. */
+        HW_AUTO_GAIN = 0x04,  /*!< Hardware AGC on or off. */
+        HW_ANTENNA   = 0x08,  /*!< Antenna connector. */
+        HW_FREQ_CORR = 0x10,  /*!< Frequency correction in ppm. */
+        HW_BANDWIDTH = 0x20   /*!< Analog bandwidth. */
+    };
+
+    /**
+     * Called in the control thread when a setting has been applied, with
+     * the name of the gain stage or antenna and the value reported by the
+     * device.
+     */
+    typedef std::function<void(hw_setting setting, const std::string &name,
+                               double value)> hw_callback;
+
+    /** Signal found or lost by the scanner. */
+    struct scan_event {
+        double  freq;   /*!< Receive frequency in Hz (RF + filter offset). */
+        float   level;  /*!< Signal level in dBFS, the peak level when lost. */
+        bool    found;  /*!< True when found, false when the scanner moves on. */
+    };
+
     receiver(const std::string input_device="",
              const std::string audio_device="",
              unsigned int decimation=1);
@@ -119,6 +150,9 @@ public:
     void        set_input_device(const std::string device);
     void        set_output_device(const std::string device);
 
+    void        set_hw_callback(hw_callback callback);
+    void        wait_hw(void);
+
     std::vector<std::string> get_antennas(void) const;
     void        set_antenna(const std::string &antenna);
 
@@ -164,10 +198,17 @@ public:
     float       get_signal_pwr(bool dbfs) const;
     void        set_iq_fft_size(int newsize);
     void        set_iq_fft_window(int window_type);
-    void        get_iq_fft_data(std::complex<float>* fftPoints,
-                                unsigned int &fftsize);
-    void        get_audio_fft_data(std::complex<float>* fftPoints,
-                                   unsigned int &fftsize);
+    void        set_iq_fft_rate(int fps);
+    void        set_iq_fft_welch(int segments, float overlap);
+    void        set_iq_fft_threads(int nthreads, unsigned int min_size);
+    void        set_iq_fft_avg(float gain);
+    void        set_iq_fft_zoom(double center, double span);
+    void        get_iq_fft_data(float* fftPoints, float* avgPoints,
+                                unsigned int &fftsize,
+                                double &center, double &bandwidth);
+    void        set_iq_fft_tracking(bool enabled);
+    void        get_iq_fft_signals(std::vector<tracked_signal> &sigs);
+    void        get_audio_fft_data(float* fftPoints, unsigned int &fftsize);
 
     /* Noise blanker */
     status      set_nb_on(int nbid, bool on);
@@ -217,6 +258,13 @@ public:
     bool        is_recording_audio(void) const { return d_recording_wav; }
     bool        is_snifffer_active(void) const { return d_sniffer_active; }
 
+    /* Scanner */
+    status      start_scan(const std::vector<double> &freqs, int dwell_ms,
+                           float threshold_db, int hold_ms);
+    void        stop_scan();
+    bool        is_scanning() const { return d_scan_thread.joinable(); }
+    void        get_scan_events(std::vector<scan_event> &events);
+
     /* rds functions */
     void        get_rds_data(std::string &outbuff, int &num);
     void        start_rds_decoder(void);
@@ -227,6 +275,12 @@ public:
 private:
     void        connect_all(rx_chain type);
     void        update_ddc();
+    void        queue_hw(unsigned int setting);
+    void        hw_thread();
+    void        tune_now(double freq_hz);
+    void        scan_thread();
+    bool        scan_wait(int ms);
+    void        add_scan_event(double freq, float level, bool found);
 
 private:
     bool        d_running;          /*!< Whether receiver is running or not. */
@@ -234,7 +288,7 @@ private:
     double      d_quad_rate;        /*!< Quadrature rate (input_rate / decim) */
     double      d_audio_rate;       /*!< Audio output rate. */
     unsigned int    d_decim;        /*!< input decimation. */
-    double      d_rf_freq;          /*!< Current RF frequency. */
+    double      d_rf_freq;          /*!< Current RF frequency (d_hw_mutex). */
     double      d_filter_offset;    /*!< Current filter offset */
     double      d_cw_offset;        /*!< CW offset */
     bool        d_recording_iq;     /*!< Whether we are recording I/Q file. */
@@ -249,6 +303,32 @@ private:
 
     rx_demod    d_demod;       /*!< Current demodulator. */
 
+    mutable boost::mutex d_src_mutex; /*!< Serializes the calls into src. */
+    mutable boost::mutex d_hw_mutex;  /*!< Locks the pending hardware settings. */
+    boost::condition_variable d_hw_cond; /*!< Signals new settings and completion. */
+    boost::thread   d_hw_thread;    /*!< Applies the hardware settings. */
+    bool            d_hw_quit;      /*!< Control thread has been asked to quit. */
+    bool            d_hw_busy;      /*!< Control thread is applying settings. */
+    unsigned int    d_hw_pending;   /*!< Settings waiting to be applied, hw_setting bits. */
+    double          d_pending_freq_corr;
+    double          d_pending_bandwidth;
+    bool            d_pending_auto_gain;
+    std::string     d_pending_antenna;
+    std::map<std::string, double> d_pending_gains; /*!< Latest value of each gain stage. */
+    hw_callback     d_hw_callback;
+    double          d_tuned_freq;   /*!< Frequency the device reported last (d_src_mutex). */
+
+    boost::mutex    d_scan_mutex;   /*!< Locks d_scan_stop and d_scan_events. */
+    boost::condition_variable d_scan_cond; /*!< Wakes the scanner when it is stopped. */
+    boost::thread   d_scan_thread;  /*!< Runs the scan loop. */
+    bool            d_scan_stop;    /*!< Scanner has been asked to stop. */
+    std::vector<double> d_scan_freqs;  /*!< Receive frequencies to scan. */
+    int             d_scan_dwell;   /*!< Time on a frequency before measuring in ms. */
+    float           d_scan_threshold;  /*!< Level of a hit in dBFS. */
+    int             d_scan_hold;    /*!< Time to stay after a hit has faded in ms. */
+    double          d_scan_offset;  /*!< Filter offset when the scan was started. */
+    std::vector<scan_event> d_scan_events; /*!< Events not yet read by the GUI. */
+
     gr::top_block_sptr         tb;        /*!< The GNU Radio top block. */
 
     osmosdr::source::sptr     src;       /*!< Real time I/Q source. */
@@ -22,14 +22,39 @@
  */
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <QDateTime>
 #include <QString>
 #include <QStringList>
+#include <QtEndian>
 #include <QtGlobal>
 #include "remote_control.h"
 
 #define DEFAULT_RC_PORT            7356
 #define DEFAULT_RC_ALLOWED_HOSTS   "::ffff:127.0.0.1"
+#define RC_MAX_LINE                1024    /* longest command line accepted, incl. newline */
+#define RC_MAX_BACKLOG             65536   /* unsent bytes before a client is dropped */
+#define RC_EVENT_NAMES             "FREQ MODE FILTER SQL STRENGTH SCAN"
+#define RC_SPECTRUM_MAGIC          "GQSP"
+#define RC_SPECTRUM_VERSION        1
+#define RC_SPECTRUM_HEADER         44      /* size of the frame header */
+#define RC_SPECTRUM_MAX_BINS       8192    /* keeps a F32 frame below 64 kB */
+#define RC_SPECTRUM_FPS            25.0
+#define RC_SCAN_MAX_FREQS          100000  /* longest scan list */
+#define RC_SCAN_DWELL              50      /* default dwell time in ms */
+#define RC_SCAN_HOLD               2000    /* default hold time in ms */
+
+/* Names of the events in the order of rc_event_t */
+const RemoteControl::rc_event_name_t RemoteControl::rc_event_names[] = {
+    { "FREQ",     RC_EVENT_FREQ },
+    { "MODE",     RC_EVENT_MODE },
+    { "FILTER",   RC_EVENT_FILTER },
+    { "SQL",      RC_EVENT_SQL },
+    { "STRENGTH", RC_EVENT_STRENGTH },
+    { "SCAN",     RC_EVENT_SCAN },
+    { 0, 0 }
+};
 
 RemoteControl::RemoteControl(QObject *parent) :
     QObject(parent)
@@ -47,11 +72,35 @@ RemoteControl::RemoteControl(QObject *parent) :
     audio_recorder_status = false;
     receiver_running = false;
     hamlib_compatible = false;
+    squelch_open = true;
+    rc_scanning = false;
+    rc_current = 0;
 
     rc_port = DEFAULT_RC_PORT;
     rc_allowed_hosts.append(DEFAULT_RC_ALLOWED_HOSTS);
 
-    rc_socket = 0;
+    rc_commands.insert("f", [this](const QStringList &) { return cmd_get_freq(); });
+    rc_commands.insert("F", [this](const QStringList &c) { return cmd_set_freq(c); });
+    rc_commands.insert("m", [this](const QStringList &) { return cmd_get_mode(); });
+    rc_commands.insert("M", [this](const QStringList &c) { return cmd_set_mode(c); });
+    rc_commands.insert("l", [this](const QStringList &c) { return cmd_get_level(c); });
+    rc_commands.insert("L", [this](const QStringList &c) { return cmd_set_level(c); });
+    rc_commands.insert("u", [this](const QStringList &c) { return cmd_get_func(c); });
+    rc_commands.insert("U", [this](const QStringList &c) { return cmd_set_func(c); });
+    rc_commands.insert("v", [this](const QStringList &) { return cmd_get_vfo(); });
+    rc_commands.insert("V", [this](const QStringList &c) { return cmd_set_vfo(c); });
+    rc_commands.insert("s", [this](const QStringList &) { return cmd_get_split_vfo(); });
+    rc_commands.insert("S", [this](const QStringList &) { return cmd_set_split_vfo(); });
+    rc_commands.insert("_", [this](const QStringList &) { return cmd_get_info(); });
+    rc_commands.insert("AOS", [this](const QStringList &) { return cmd_AOS(); });
+    rc_commands.insert("LOS", [this](const QStringList &) { return cmd_LOS(); });
+    rc_commands.insert("LNB_LO", [this](const QStringList &c) { return cmd_lnb_lo(c); });
+    rc_commands.insert("\\dump_state", [this](const QStringList &) { return cmd_dump_state(); });
+    rc_commands.insert("SIGNALS", [this](const QStringList &) { return cmd_get_signals(); });
+    rc_commands.insert("SUBSCRIBE", [this](const QStringList &c) { return cmd_subscribe(c); });
+    rc_commands.insert("UNSUBSCRIBE", [this](const QStringList &c) { return cmd_unsubscribe(c); });
+    rc_commands.insert("SPECTRUM", [this](const QStringList &c) { return cmd_spectrum(c); });
+    rc_commands.insert("SCAN", [this](const QStringList &c) { return cmd_scan(c); });
 
 #if QT_VERSION < 0x050900
     // Disable proxy setting detected by Qt
@@ -79,11 +128,8 @@ void RemoteControl::start_server()
 /*! \brief Stop the server. */
 void RemoteControl::stop_server()
 {
-    if (rc_socket != 0) {
-        rc_socket->close();
-        rc_socket->deleteLater();
-        rc_socket = 0;
-    }
+    while (!rc_sockets.isEmpty())
+        closeClient(rc_sockets.first());
 
     if (rc_server.isListening())
         rc_server.close();
@@ -165,100 +211,124 @@ void RemoteControl::setHosts(QStringList hosts)
  */
 void RemoteControl::acceptConnection()
 {
-    if (rc_socket)
-    {
-        rc_socket->close();
-        rc_socket->deleteLater();
-    }
-    rc_socket = rc_server.nextPendingConnection();
+    QTcpSocket *socket;
 
-    // check if host is allowed
-    QString address = rc_socket->peerAddress().toString();
-    if (rc_allowed_hosts.indexOf(address) == -1)
+    while ((socket = rc_server.nextPendingConnection()) != 0)
     {
-        std::cout << "*** Remote connection attempt from " << address.toStdString()
-                  << " (not in allowed list)" << std::endl;
-        rc_socket->close();
-        rc_socket->deleteLater();
-        rc_socket = 0;
-    }
-    else
-    {
-        connect(rc_socket, SIGNAL(readyRead()), this, SLOT(startRead()));
+        // check if host is allowed
+        QString address = socket->peerAddress().toString();
+        if (rc_allowed_hosts.indexOf(address) == -1)
+        {
+            std::cout << "*** Remote connection attempt from " << address.toStdString()
+                      << " (not in allowed list)" << std::endl;
+            socket->close();
+            socket->deleteLater();
+            continue;
+        }
+
+        rc_sockets.append(socket);
+        connect(socket, SIGNAL(readyRead()), this, SLOT(startRead()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(clientDisconnected()));
     }
 }
 
+/*! \brief Forget a client when the connection has been closed by the peer. */
+void RemoteControl::clientDisconnected()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+
+    if (socket && rc_sockets.contains(socket))
+        closeClient(socket);
+}
+
+/*! \brief Close a client connection. */
+void RemoteControl::closeClient(QTcpSocket *socket)
+{
+    rc_sockets.removeAll(socket);
+    rc_subscriptions.remove(socket);
+    rc_spectrum.remove(socket);
+    rc_discard.remove(socket);
+    socket->disconnect(this);
+    socket->close();
+    socket->deleteLater();
+
+    if (rc_signal_clients.remove(socket) && rc_signal_clients.isEmpty())
+        emit signalClientsChanged();
+}
+
 /*! \brief Start reading from the socket.
  *
- * This slot is called when the client TCP socket emits a readyRead() signal,
- * i.e. when there is data to read.
+ * This slot is called when a client TCP socket emits a readyRead() signal,
+ * i.e. when there is data to read. All complete lines are executed and the
+ * answers are written back together. An incomplete line stays in the socket
+ * buffer until the rest of it arrives. A line longer than RC_MAX_LINE is
+ * answered with a single error and skipped up to its newline.
  */
 void RemoteControl::startRead()
 {
-    char    buffer[1024] = {0};
-    int     bytes_read;
-    QString answer = "";
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    QByteArray  answers;
 
-    bytes_read = rc_socket->readLine(buffer, 1024);
-    if (bytes_read < 2)  // command + '\n'
+    if (!socket || !rc_sockets.contains(socket))
         return;
 
-    QStringList cmdlist = QString(buffer).trimmed().split(" ", QString::SkipEmptyParts);
+    while (socket->bytesAvailable() > 0)
+    {
+        if (rc_discard.contains(socket))
+        {
+            // throw away the rest of an overlong line
+            if (socket->readLine(RC_MAX_LINE + 1).endsWith('\n'))
+                rc_discard.remove(socket);
+            continue;
+        }
 
-    if (cmdlist.size() == 0)
-        return;
+        // wait for the rest of the line
+        if (!socket->canReadLine() && socket->bytesAvailable() <= RC_MAX_LINE)
+            break;
 
-    QString cmd = cmdlist[0];
-    if (cmd == "f")
-        answer = cmd_get_freq();
-    else if (cmd == "F")
-        answer = cmd_set_freq(cmdlist);
-    else if (cmd == "m")
-        answer = cmd_get_mode();
-    else if (cmd == "M")
-        answer = cmd_set_mode(cmdlist);
-    else if (cmd == "l")
-        answer = cmd_get_level(cmdlist);
-    else if (cmd == "L")
-        answer = cmd_set_level(cmdlist);
-    else if (cmd == "u")
-        answer = cmd_get_func(cmdlist);
-    else if (cmd == "U")
-        answer = cmd_set_func(cmdlist);
-    else if (cmd == "v")
-        answer = cmd_get_vfo();
-    else if (cmd == "V")
-        answer = cmd_set_vfo(cmdlist);
-    else if (cmd == "s")
-        answer = cmd_get_split_vfo();
-    else if (cmd == "S")
-        answer = cmd_set_split_vfo();
-    else if (cmd == "_")
-        answer = cmd_get_info();
-    else if (cmd == "AOS")
-        answer = cmd_AOS();
-    else if (cmd == "LOS")
-        answer = cmd_LOS();
-    else if (cmd == "LNB_LO")
-        answer = cmd_lnb_lo(cmdlist);
-    else if (cmd == "\\dump_state")
-        answer = cmd_dump_state();
-    else if (cmd == "q" || cmd == "Q")
-    {
-        // FIXME: for now we assume 'close' command
-        rc_socket->close();
-        rc_socket->deleteLater();
-        rc_socket = 0;
-        return;
-    }
-    else
-    {
-        // print unknown command and respond with an error
-        qWarning() << "Unknown remote command:" << cmdlist;
-        answer = QString("RPRT 1\n");
+        QByteArray line = socket->readLine(RC_MAX_LINE + 1);
+        if (!line.endsWith('\n'))
+        {
+            // too long to be a command, answer once and skip to its end
+            rc_discard.insert(socket);
+            answers += "RPRT 1\n";
+            continue;
+        }
+
+        QStringList cmdlist = QString::fromLatin1(line).trimmed().split(" ", QString::SkipEmptyParts);
+
+        if (cmdlist.size() == 0)
+            continue;
+
+        QString cmd = cmdlist[0];
+        if (cmd == "q" || cmd == "Q")
+        {
+            // FIXME: for now we assume 'close' command
+            if (!answers.isEmpty())
+                socket->write(answers);
+            closeClient(socket);
+            return;
+        }
+
+        QHash<QString, rc_command_t>::const_iterator it = rc_commands.constFind(cmd);
+        if (it != rc_commands.constEnd())
+        {
+            rc_current = socket;
+            answers += it.value()(cmdlist).toLatin1();
+            rc_current = 0;
+            if (!rc_sockets.contains(socket))
+                return;
+        }
+        else
+        {
+            // print unknown command and respond with an error
+            qWarning() << "Unknown remote command:" << cmdlist;
+            answers += "RPRT 1\n";
+        }
     }
 
-    rc_socket->write(answer.toLatin1());
+    if (!answers.isEmpty())
+        socket->write(answers);
 }
 
 /*! \brief Slot called when the receiver is tuned to a new frequency.
@@ -269,6 +339,8 @@ void RemoteControl::startRead()
  */
 void RemoteControl::setNewFrequency(qint64 freq)
 {
+    if (freq != rc_freq)
+        sendEvent(RC_EVENT_FREQ, QString::number(freq));
     rc_freq = freq;
 }
 
@@ -296,11 +368,214 @@ void RemoteControl::setBandwidth(qint64 bw)
 void RemoteControl::setSignalLevel(float level)
 {
     signal_level = level;
+    updateSquelchState();
+
+    if (rc_subscriptions.isEmpty())
+        return;
+
+    // strength events are rate limited per client
+    qint64  now = QDateTime::currentMSecsSinceEpoch();
+    QString text = QString("EVENT STRENGTH %1\n").arg(signal_level, 0, 'f', 1);
+
+    QList<QTcpSocket*> stalled;
+
+    QHash<QTcpSocket*, rc_subscription_t>::iterator it;
+    for (it = rc_subscriptions.begin(); it != rc_subscriptions.end(); ++it)
+    {
+        rc_subscription_t &sub = it.value();
+
+        if ((sub.events & RC_EVENT_STRENGTH) &&
+            now - sub.strength_last >= sub.strength_interval)
+        {
+            sub.strength_last = now;
+            if (!writeEvent(it.key(), text.toLatin1()))
+                stalled.append(it.key());
+        }
+    }
+
+    for (int i = 0; i < stalled.size(); i++)
+        closeClient(stalled[i]);
+}
+
+/*! \brief Set the signals found by the signal tracker (from mainwindow). */
+void RemoteControl::setSignals(const std::vector<tracked_signal> &sigs)
+{
+    rc_signals = sigs;
+}
+
+/*! \brief Set new spectrum data (from mainwindow).
+ *  \param data FFT data in dB, lowest frequency first.
+ *  \param size Number of FFT bins in data.
+ *  \param center Absolute center frequency of the data in Hz.
+ *  \param bandwidth Bandwidth covered by the data in Hz.
+ *
+ * This is the frame shown on the plotter. It is sent to the clients that
+ * requested the spectrum with SPECTRUM and whose next frame is due.
+ */
+void RemoteControl::setSpectrum(const float *data, int size, qint64 center,
+                                float bandwidth)
+{
+    if (rc_spectrum.isEmpty() || size <= 0)
+        return;
+
+    qint64  now = QDateTime::currentMSecsSinceEpoch();
+
+    QHash<QTcpSocket*, rc_spectrum_t>::iterator it;
+    for (it = rc_spectrum.begin(); it != rc_spectrum.end(); ++it)
+    {
+        rc_spectrum_t &spec = it.value();
+
+        if (now < spec.next)
+            continue;
+
+        // keep the average rate when the FFT timer is not a multiple of it
+        spec.next = qMax(spec.next + spec.interval, now);
+        sendSpectrum(spec, data, size, center, bandwidth, now);
+    }
+}
+
+static char *put_u16(char *p, quint16 val)
+{
+    qToLittleEndian(val, (uchar *)p);
+    return p + 2;
+}
+
+static char *put_u32(char *p, quint32 val)
+{
+    qToLittleEndian(val, (uchar *)p);
+    return p + 4;
+}
+
+static char *put_u64(char *p, quint64 val)
+{
+    qToLittleEndian(val, (uchar *)p);
+    return p + 8;
+}
+
+static char *put_f32(char *p, float val)
+{
+    quint32 bits;
+
+    memcpy(&bits, &val, sizeof(bits));
+    return put_u32(p, bits);
+}
+
+/*! \brief Reduce a spectrum frame and send it as one UDP datagram.
+ *
+ * The frame header is little endian:
+ *
+ *   char[4]  magic "GQSP"
+ *   u16      version
+ *   u16      format, 0 = U8, 1 = F32
+ *   u32      sequence number
+ *   u32      number of bins
+ *   u64      time stamp in ms since the epoch
+ *   i64      center frequency in Hz
+ *   f32      bandwidth in Hz
+ *   f32      level of the U8 value 0 in dB
+ *   f32      level of the U8 value 255 in dB
+ *
+ * followed by the bins, lowest frequency first.
+ */
+void RemoteControl::sendSpectrum(rc_spectrum_t &spec, const float *data,
+                                 int size, qint64 center, float bandwidth,
+                                 qint64 now)
+{
+    int     bins = qMin(size, RC_SPECTRUM_MAX_BINS);
+    int     i, j, k;
+
+    if (spec.bins > 0)
+        bins = qMin(bins, spec.bins);
+
+    // combine groups of FFT bins into the bins sent
+    rc_spectrum_bins.resize(bins);
+    for (i = 0, j = 0; i < bins; i++)
+    {
+        int     end = (qint64)(i + 1) * size / bins;
+        float   val = data[j];
+
+        if (spec.reduce == RC_REDUCE_MAX)
+        {
+            for (k = j + 1; k < end; k++)
+                val = qMax(val, data[k]);
+        }
+        else if (spec.reduce == RC_REDUCE_MIN)
+        {
+            for (k = j + 1; k < end; k++)
+                val = qMin(val, data[k]);
+        }
+        else
+        {
+            for (k = j + 1; k < end; k++)
+                val += data[k];
+            val /= (end - j);
+        }
+        rc_spectrum_bins[i] = val;
+        j = end;
+    }
+
+    int sample_size = spec.format == RC_FORMAT_U8 ? 1 : 4;
+    rc_spectrum_frame.resize(RC_SPECTRUM_HEADER + bins * sample_size);
+
+    char *p = rc_spectrum_frame.data();
+    memcpy(p, RC_SPECTRUM_MAGIC, 4);
+    p = put_u16(p + 4, RC_SPECTRUM_VERSION);
+    p = put_u16(p, spec.format);
+    p = put_u32(p, spec.sequence++);
+    p = put_u32(p, bins);
+    p = put_u64(p, now);
+    p = put_u64(p, center);
+    p = put_f32(p, bandwidth);
+    p = put_f32(p, spec.min_db);
+    p = put_f32(p, spec.max_db);
+
+    if (spec.format == RC_FORMAT_U8)
+    {
+        float scale = 255.f / (spec.max_db - spec.min_db);
+
+        for (i = 0; i < bins; i++)
+            *p++ = (char)(uchar)qBound(0.f, (rc_spectrum_bins[i] - spec.min_db) * scale, 255.f);
+    }
+    else
+    {
+        for (i = 0; i < bins; i++)
+            p = put_f32(p, rc_spectrum_bins[i]);
+    }
+
+    rc_spectrum_socket.writeDatagram(rc_spectrum_frame, spec.address, spec.port);
+}
+
+/*! \brief Report a scanner event (from mainwindow).
+ *  \param found True when a signal has been found, false when the scanner
+ *               leaves it.
+ *  \param freq The frequency in Hz.
+ *  \param level The signal level in dBFS, the peak level when left.
+ */
+void RemoteControl::setScanEvent(bool found, qint64 freq, float level)
+{
+    sendEvent(RC_EVENT_SCAN, QString("%1 %2 %3")
+              .arg(found ? "HIT" : "LOST").arg(freq).arg(level, 0, 'f', 1));
+}
+
+/*! \brief The scanner has stopped (from mainwindow).
+ *  \param reason REQUEST for SCAN STOP, TUNE, DSP or DEVICE when the
+ *                receiver has been retuned, stopped or got a new input
+ *                device, ERROR if the scan could not be started.
+ */
+void RemoteControl::setScanStopped(const QString &reason)
+{
+    if (!rc_scanning)
+        return;
+
+    rc_scanning = false;
+    sendEvent(RC_EVENT_SCAN, QString("STOPPED %1").arg(reason));
 }
 
 /*! \brief Set demodulator (from mainwindow). */
 void RemoteControl::setMode(int mode)
 {
+    if (mode != rc_mode)
+        sendEvent(RC_EVENT_MODE, intToModeStr(mode));
     rc_mode = mode;
 
     if (rc_mode == 0)
@@ -310,6 +585,8 @@ void RemoteControl::setMode(int mode)
 /*! \brief Set passband (from mainwindow). */
 void RemoteControl::setPassband(int passband_lo, int passband_hi)
 {
+    if (passband_lo != rc_passband_lo || passband_hi != rc_passband_hi)
+        sendEvent(RC_EVENT_FILTER, QString("%1 %2").arg(passband_lo).arg(passband_hi));
     rc_passband_lo = passband_lo;
     rc_passband_hi = passband_hi;
 }
@@ -339,13 +616,87 @@ void RemoteControl::setNewRemoteFreq(qint64 freq)
         emit newFrequency(freq);
     }
 
+    if (freq != rc_freq)
+        sendEvent(RC_EVENT_FREQ, QString::number(freq));
     rc_freq = freq;
 }
 
+/*! \brief Send an event to the clients that have subscribed to it.
+ *  \param event The event.
+ *  \param text The event data, without the "EVENT <name>" prefix.
+ */
+void RemoteControl::sendEvent(rc_event_t event, const QString &text)
+{
+    if (rc_subscriptions.isEmpty())
+        return;
+
+    QString name;
+    for (int i = 0; rc_event_names[i].name; i++)
+        if (rc_event_names[i].event == event)
+            name = rc_event_names[i].name;
+
+    QByteArray line = QString("EVENT %1 %2\n").arg(name).arg(text).toLatin1();
+
+    QList<QTcpSocket*> stalled;
+
+    QHash<QTcpSocket*, rc_subscription_t>::const_iterator it;
+    for (it = rc_subscriptions.constBegin(); it != rc_subscriptions.constEnd(); ++it)
+    {
+        if ((it.value().events & event) && !writeEvent(it.key(), line))
+            stalled.append(it.key());
+    }
+
+    for (int i = 0; i < stalled.size(); i++)
+        closeClient(stalled[i]);
+}
+
+/*! \brief Write an event line to a client.
+ *  \return False if the client has more than RC_MAX_BACKLOG bytes of
+ *          output pending, i.e. it does not read its events.
+ *
+ * The line is not written in that case and the caller is expected to close
+ * the connection; dropping single events would leave the client with a
+ * wrong idea of the receiver state.
+ */
+bool RemoteControl::writeEvent(QTcpSocket *socket, const QByteArray &line)
+{
+    if (socket->bytesToWrite() > RC_MAX_BACKLOG)
+    {
+        qWarning() << "Remote control client" << socket->peerAddress().toString()
+                   << "does not read its events, closing connection";
+        return false;
+    }
+
+    socket->write(line);
+    return true;
+}
+
+/*! \brief Convert an event name to rc_event_t, 0 if the name is unknown. */
+quint32 RemoteControl::eventFromName(const QString &name) const
+{
+    for (int i = 0; rc_event_names[i].name; i++)
+        if (name.compare(rc_event_names[i].name, Qt::CaseInsensitive) == 0)
+            return rc_event_names[i].event;
+    return 0;
+}
+
+/*! \brief Send a squelch event if the squelch has opened or closed. */
+void RemoteControl::updateSquelchState()
+{
+    bool open = signal_level >= squelch_level;
+
+    if (open != squelch_open)
+    {
+        squelch_open = open;
+        sendEvent(RC_EVENT_SQL, open ? "OPEN" : "CLOSED");
+    }
+}
+
 /*! \brief Set squelch level (from mainwindow). */
 void RemoteControl::setSquelchLevel(double level)
 {
     squelch_level = level;
+    updateSquelchState();
 }
 
 /*! \brief Start audio recorder (from mainwindow). */
@@ -571,6 +922,8 @@ QString RemoteControl::cmd_set_mode(QStringList cmdlist)
         }
         else
         {
+            if (mode != rc_mode)
+                sendEvent(RC_EVENT_MODE, intToModeStr(mode));
             rc_mode = mode;
             emit newMode(rc_mode);
 
@@ -768,6 +1121,268 @@ QString RemoteControl::cmd_get_info() const
     return QString("Gqrx %1\n").arg(VERSION);
 };
 
+/*
+ * Gqrx specific command: SIGNALS - list of signals found by the signal
+ * tracker. The first line is the number of signals followed by one line
+ * per signal: frequency [Hz], bandwidth [Hz], level [dBFS], SNR [dB] and
+ * the number of FFT frames the signal has been seen in.
+ *
+ * The tracker only runs while a client uses this command, so the first
+ * answer may be empty.
+ */
+QString RemoteControl::cmd_get_signals()
+{
+    QString answer = QString("%1\n").arg(rc_signals.size());
+
+    if (rc_current && !rc_signal_clients.contains(rc_current))
+    {
+        rc_signal_clients.insert(rc_current);
+        if (rc_signal_clients.size() == 1)
+            emit signalClientsChanged();
+    }
+
+    for (size_t i = 0; i < rc_signals.size(); i++)
+    {
+        const tracked_signal &sig = rc_signals[i];
+
+        answer += QString("%1 %2 %3 %4 %5\n")
+                .arg((qint64)llround(sig.frequency))
+                .arg((qint64)llround(sig.bandwidth))
+                .arg(sig.level, 0, 'f', 1)
+                .arg(sig.snr, 0, 'f', 1)
+                .arg(sig.hits);
+    }
+
+    return answer;
+}
+
+/*
+ * Gqrx specific command: SUBSCRIBE <event> [rate] - send events to this
+ * client instead of having it poll. Events are FREQ, MODE, FILTER, SQL,
+ * STRENGTH and SCAN. For STRENGTH an optional rate in Hz limits the number of events,
+ * the default is every meter update.
+ */
+QString RemoteControl::cmd_subscribe(QStringList cmdlist)
+{
+    QString name = cmdlist.value(1, "");
+    quint32 event = eventFromName(name);
+
+    if (name == "?")
+        return QString(RC_EVENT_NAMES "\n");
+
+    if (event == 0 || !rc_current)
+        return QString("RPRT 1\n");
+
+    if (!rc_subscriptions.contains(rc_current))
+    {
+        rc_subscription_t sub = { 0, 0, 0 };
+        rc_subscriptions.insert(rc_current, sub);
+    }
+    rc_subscription_t &sub = rc_subscriptions[rc_current];
+
+    if (event == RC_EVENT_STRENGTH)
+    {
+        bool    ok = true;
+        double  rate = cmdlist.value(2, "0").toDouble(&ok);
+
+        if (!ok || rate < 0.0)
+            return QString("RPRT 1\n");
+        sub.strength_interval = rate > 0.0 ? (qint64)(1000.0 / rate) : 0;
+        sub.strength_last = 0;
+    }
+    sub.events |= event;
+
+    return QString("RPRT 0\n");
+}
+
+/*
+ * Gqrx specific command: UNSUBSCRIBE [event] - stop sending an event, or
+ * all events if no event is given.
+ */
+QString RemoteControl::cmd_unsubscribe(QStringList cmdlist)
+{
+    if (!rc_current)
+        return QString("RPRT 1\n");
+
+    if (cmdlist.size() < 2)
+    {
+        rc_subscriptions.remove(rc_current);
+        return QString("RPRT 0\n");
+    }
+
+    quint32 event = eventFromName(cmdlist[1]);
+    if (event == 0)
+        return QString("RPRT 1\n");
+
+    if (rc_subscriptions.contains(rc_current))
+    {
+        rc_subscriptions[rc_current].events &= ~event;
+        if (rc_subscriptions[rc_current].events == 0)
+            rc_subscriptions.remove(rc_current);
+    }
+
+    return QString("RPRT 0\n");
+}
+
+/*
+ * Gqrx specific command: SPECTRUM <port> [bins [MAX|MIN|AVG [U8|F32 [fps
+ * [min_db max_db]]]]] - send the spectrum as UDP frames to the port on the
+ * client host. SPECTRUM OFF stops the frames.
+ */
+QString RemoteControl::cmd_spectrum(QStringList cmdlist)
+{
+    if (!rc_current || cmdlist.size() < 2)
+        return QString("RPRT 1\n");
+
+    if (cmdlist[1].toUpper() == "OFF")
+    {
+        rc_spectrum.remove(rc_current);
+        return QString("RPRT 0\n");
+    }
+
+    rc_spectrum_t spec;
+    bool    ok = true;
+    int     port = cmdlist[1].toInt(&ok);
+
+    if (!ok || port <= 0 || port > 65535)
+        return QString("RPRT 1\n");
+
+    // reply to the host the command came from, also when it is IPv4 mapped
+    spec.address = rc_current->peerAddress();
+    quint32 ipv4 = spec.address.toIPv4Address(&ok);
+    if (ok)
+        spec.address = QHostAddress(ipv4);
+
+    spec.port = port;
+    spec.bins = cmdlist.value(2, "0").toInt(&ok);
+    if (!ok || spec.bins < 0)
+        return QString("RPRT 1\n");
+
+    QString reduce = cmdlist.value(3, "MAX").toUpper();
+    if (reduce == "MAX")
+        spec.reduce = RC_REDUCE_MAX;
+    else if (reduce == "MIN")
+        spec.reduce = RC_REDUCE_MIN;
+    else if (reduce == "AVG")
+        spec.reduce = RC_REDUCE_AVG;
+    else
+        return QString("RPRT 1\n");
+
+    QString format = cmdlist.value(4, "U8").toUpper();
+    if (format == "U8")
+        spec.format = RC_FORMAT_U8;
+    else if (format == "F32")
+        spec.format = RC_FORMAT_F32;
+    else
+        return QString("RPRT 1\n");
+
+    double fps = cmdlist.value(5, QString::number(RC_SPECTRUM_FPS)).toDouble(&ok);
+    if (!ok || fps < 0.0)
+        return QString("RPRT 1\n");
+    spec.interval = fps > 0.0 ? (qint64)(1000.0 / fps) : 0;
+
+    spec.min_db = -160.f;
+    spec.max_db = 0.f;
+    if (cmdlist.size() > 6)
+    {
+        bool ok2 = false;
+
+        spec.min_db = cmdlist[6].toFloat(&ok);
+        spec.max_db = cmdlist.value(7, "").toFloat(&ok2);
+        if (!ok || !ok2 || spec.max_db <= spec.min_db)
+            return QString("RPRT 1\n");
+    }
+
+    spec.next = 0;
+    spec.sequence = 0;
+    rc_spectrum.insert(rc_current, spec);
+
+    return QString("RPRT 0\n");
+}
+
+/*
+ * Gqrx specific command: SCAN - scan frequencies in the receiver.
+ *
+ *   SCAN RANGE <start> <stop> <step> [dwell_ms [level [hold_ms]]]
+ *   SCAN LIST <freq>[,<freq>...] [dwell_ms [level [hold_ms]]]
+ *   SCAN STOP
+ *   SCAN            - returns 1 while scanning, 0 otherwise
+ *
+ * The scanner stays on a frequency while the signal is at or above level
+ * and hold_ms after it has faded. The level defaults to the squelch level.
+ */
+QString RemoteControl::cmd_scan(QStringList cmdlist)
+{
+    QString sub = cmdlist.value(1, "").toUpper();
+
+    if (sub.isEmpty())
+        return QString("%1\n").arg(rc_scanning ? 1 : 0);
+
+    // rc_scanning is cleared by setScanStopped()
+    if (sub == "STOP")
+    {
+        emit stopScan();
+        return QString("RPRT 0\n");
+    }
+
+    if (!receiver_running)
+        return QString("RPRT 1\n");
+
+    QList<qint64>   freqs;
+    bool            ok = true;
+    int             next;
+
+    if (sub == "RANGE" && cmdlist.size() >= 5)
+    {
+        bool    ok1, ok2, ok3;
+        qint64  start = cmdlist[2].toLongLong(&ok1);
+        qint64  stop = cmdlist[3].toLongLong(&ok2);
+        qint64  step = cmdlist[4].toLongLong(&ok3);
+
+        if (!ok1 || !ok2 || !ok3 || step <= 0 || stop < start ||
+            (stop - start) / step >= RC_SCAN_MAX_FREQS)
+            return QString("RPRT 1\n");
+
+        for (qint64 freq = start; freq <= stop; freq += step)
+            freqs.append(freq);
+        next = 5;
+    }
+    else if (sub == "LIST" && cmdlist.size() >= 3)
+    {
+        QStringList list = cmdlist[2].split(",", QString::SkipEmptyParts);
+
+        if (list.isEmpty() || list.size() > RC_SCAN_MAX_FREQS)
+            return QString("RPRT 1\n");
+
+        for (int i = 0; i < list.size() && ok; i++)
+            freqs.append(list[i].toLongLong(&ok));
+        next = 3;
+    }
+    else
+    {
+        return QString("RPRT 1\n");
+    }
+
+    int     dwell = RC_SCAN_DWELL;
+    double  level = squelch_level;
+    int     hold = RC_SCAN_HOLD;
+
+    if (ok && cmdlist.size() > next)
+        dwell = cmdlist[next].toInt(&ok);
+    if (ok && cmdlist.size() > next + 1)
+        level = cmdlist[next + 1].toDouble(&ok);
+    if (ok && cmdlist.size() > next + 2)
+        hold = cmdlist[next + 2].toInt(&ok);
+
+    if (!ok || dwell <= 0 || hold < 0)
+        return QString("RPRT 1\n");
+
+    rc_scanning = true;
+    emit startScan(freqs, dwell, level, hold);
+
+    return QString("RPRT 0\n");
+}
+
 /* Gpredict / Gqrx specific command: AOS - satellite AOS event */
 QString RemoteControl::cmd_AOS()
 {
@@ -23,16 +23,23 @@
 #ifndef REMOTE_CONTROL_H
 #define REMOTE_CONTROL_H
 
+#include <functional>
+#include <QHash>
+#include <QList>
 #include <QObject>
+#include <QSet>
 #include <QSettings>
 #include <QString>
 #include <QStringList>
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <QUdpSocket>
 #include <QtNetwork>
+#include <vector>
 
 /* For gain_t and gain_list_t */
 #include "qtgui/dockinputctl.h"
+#include "dsp/signal_tracker.h"
 
 /*! \brief Simple TCP server for remote control.
  *
@@ -53,8 +60,15 @@
  *
  *  close: Close connection (useful for interactive telnet sessions).
  *
+ * Several clients can be connected at the same time. Commands may be
+ * pipelined; all complete lines received are executed in order and the
+ * answers are sent back in one write.
  *
- * FIXME: The server code is very minimalistic and probably not very robust.
+ * A client can subscribe to events instead of polling, see cmd_subscribe().
+ * Events are sent as lines starting with "EVENT".
+ *
+ * A client can also request the spectrum as binary UDP frames, see
+ * cmd_spectrum() and sendSpectrum().
  */
 class RemoteControl : public QObject
 {
@@ -82,6 +96,14 @@ public:
     }
     void setReceiverStatus(bool enabled);
     void setGainStages(gain_list_t &gain_list);
+    void setSignals(const std::vector<tracked_signal> &sigs);
+    bool hasSignalClients(void) const
+    {
+        return !rc_signal_clients.isEmpty();
+    }
+    void setSpectrum(const float *data, int size, qint64 center, float bandwidth);
+    void setScanEvent(bool found, qint64 freq, float level);
+    void setScanStopped(const QString &reason);
 
 public slots:
     void setNewFrequency(qint64 freq);
@@ -106,14 +128,69 @@ signals:
     void startAudioRecorderEvent();
     void stopAudioRecorderEvent();
     void gainChanged(QString name, double value);
+    void startScan(QList<qint64> freqs, int dwell_ms, double threshold, int hold_ms);
+    void stopScan();
+    void signalClientsChanged();
 
 private slots:
     void acceptConnection();
     void startRead();
+    void clientDisconnected();
 
 private:
+    typedef std::function<QString(const QStringList &)> rc_command_t;
+
+    /*! \brief Events a client can subscribe to. */
+    enum rc_event_t {
+        RC_EVENT_FREQ     = 0x01,  /*!< Receive frequency changed. */
+        RC_EVENT_MODE     = 0x02,  /*!< Demodulator changed. */
+        RC_EVENT_FILTER   = 0x04,  /*!< Filter passband changed. */
+        RC_EVENT_SQL      = 0x08,  /*!< Squelch opened or closed. */
+        RC_EVENT_STRENGTH = 0x10,  /*!< Signal strength samples. */
+        RC_EVENT_SCAN     = 0x20   /*!< Scanner found or left a signal. */
+    };
+
+    struct rc_event_name_t {
+        const char *name;
+        quint32     event;
+    };
+    static const rc_event_name_t rc_event_names[];
+
+    /*! \brief Events subscribed by a client. */
+    struct rc_subscription_t {
+        quint32     events;             /*!< Bit mask of rc_event_t. */
+        qint64      strength_interval;  /*!< Min time between strength events in ms. */
+        qint64      strength_last;      /*!< Time of the last strength event in ms. */
+    };
+
+    /*! \brief Spectrum stream requested by a client. */
+    struct rc_spectrum_t {
+        QHostAddress address;   /*!< Destination of the UDP frames. */
+        quint16     port;
+        int         bins;       /*!< Number of bins sent, 0 for all. */
+        int         reduce;     /*!< How bins are combined, rc_reduce_t. */
+        int         format;     /*!< Sample format, rc_format_t. */
+        float       min_db;     /*!< Level of the 8 bit value 0. */
+        float       max_db;     /*!< Level of the 8 bit value 255. */
+        qint64      interval;   /*!< Min time between frames in ms. */
+        qint64      next;       /*!< Time the next frame is due in ms. */
+        quint32     sequence;   /*!< Number of the next frame. */
+    };
+
+    enum rc_reduce_t { RC_REDUCE_MAX = 0, RC_REDUCE_MIN = 1, RC_REDUCE_AVG = 2 };
+    enum rc_format_t { RC_FORMAT_U8 = 0, RC_FORMAT_F32 = 1 };
+
     QTcpServer  rc_server;         /*!< The active server object. */
-    QTcpSocket* rc_socket;         /*!< The active socket object. */
+    QList<QTcpSocket*> rc_sockets; /*!< The connected clients. */
+    QHash<QString, rc_command_t> rc_commands; /*!< Command handlers by name. */
+    QHash<QTcpSocket*, rc_subscription_t> rc_subscriptions; /*!< Clients with subscribed events. */
+    QTcpSocket* rc_current;        /*!< Client whose command is being executed. */
+    QSet<QTcpSocket*> rc_discard;  /*!< Clients that sent an overlong line. */
+    QHash<QTcpSocket*, rc_spectrum_t> rc_spectrum; /*!< Clients receiving the spectrum. */
+    QSet<QTcpSocket*> rc_signal_clients; /*!< Clients that used SIGNALS. */
+    QUdpSocket  rc_spectrum_socket; /*!< Socket used to send the spectrum frames. */
+    std::vector<float> rc_spectrum_bins; /*!< Reduced bins of the current frame. */
+    QByteArray  rc_spectrum_frame; /*!< Frame being sent, reused between frames. */
 
     QStringList rc_allowed_hosts;  /*!< Hosts where we accept connection from. */
     int         rc_port;           /*!< The port we are listening on. */
@@ -131,9 +208,19 @@ private:
     bool        audio_recorder_status; /*!< Recording enabled */
     bool        receiver_running;  /*!< Wether the receiver is running or not */
     bool        hamlib_compatible;
+    bool        squelch_open;      /*!< Signal level above the squelch level */
+    bool        rc_scanning;       /*!< Scanner started with SCAN */
     gain_list_t gains;             /*!< Possible and current gain settings */
+    std::vector<tracked_signal> rc_signals; /*!< Signals found by the signal tracker */
 
     void        setNewRemoteFreq(qint64 freq);
+    void        closeClient(QTcpSocket *socket);
+    void        sendEvent(rc_event_t event, const QString &text);
+    bool        writeEvent(QTcpSocket *socket, const QByteArray &line);
+    void        sendSpectrum(rc_spectrum_t &spec, const float *data, int size,
+                             qint64 center, float bandwidth, qint64 now);
+    quint32     eventFromName(const QString &name) const;
+    void        updateSquelchState();
     int         modeStrToInt(QString mode_str);
     QString     intToModeStr(int mode);
 
@@ -155,6 +242,11 @@ private:
     QString     cmd_LOS();
     QString     cmd_lnb_lo(QStringList cmdlist);
     QString     cmd_dump_state() const;
+    QString     cmd_get_signals();
+    QString     cmd_subscribe(QStringList cmdlist);
+    QString     cmd_unsubscribe(QStringList cmdlist);
+    QString     cmd_spectrum(QStringList cmdlist);
+    QString     cmd_scan(QStringList cmdlist);
 };
 
 #endif // REMOTE_CONTROL_H
@@ -0,0 +1,98 @@
+/* -*- c++ -*- */
+/*
+ * Gqrx SDR: Software defined radio receiver powered by GNU Radio and Qt
+ *           http://gqrx.dk/
+ *
+ * Copyright 2011-2013 Alexandru Csete OZ9AEC.
+ *
+ * Gqrx is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Gqrx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Gqrx; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#include <iostream>
+#include <fftw3.h>
+#include <gnuradio/fft/fft.h>
+#include "dsp/fft_planner.h"
+
+std::string     fft_planner::d_wisdom_file;
+boost::thread   fft_planner::d_thread;
+
+/*! \brief Import FFTW wisdom from file.
+ *  \param filename The wisdom file. It is also used by save_wisdom().
+ *
+ * It is not an error if the file does not exist yet.
+ */
+void fft_planner::load_wisdom(const std::string &filename)
+{
+    gr::fft::planner::scoped_lock lock(gr::fft::planner::mutex());
+
+    d_wisdom_file = filename;
+    if (!fftwf_import_wisdom_from_filename(d_wisdom_file.c_str()))
+    {
+#ifndef QT_NO_DEBUG_OUTPUT
+        std::cout << "No FFTW wisdom loaded from " << d_wisdom_file << std::endl;
+#endif
+    }
+}
+
+/*! \brief Export the current FFTW wisdom to the file given to load_wisdom(). */
+void fft_planner::save_wisdom(void)
+{
+    gr::fft::planner::scoped_lock lock(gr::fft::planner::mutex());
+
+    if (d_wisdom_file.empty())
+        return;
+
+    if (!fftwf_export_wisdom_to_filename(d_wisdom_file.c_str()))
+        std::cerr << "Failed to save FFTW wisdom to " << d_wisdom_file << std::endl;
+}
+
+/*! \brief Create FFT plans in a background thread.
+ *  \param sizes The FFT sizes to plan, in order.
+ *
+ * The plans are discarded once created; only the wisdom is kept and saved.
+ * Sizes for which wisdom already exists take almost no time.
+ */
+void fft_planner::preplan(const std::vector<unsigned int> &sizes)
+{
+    stop();
+    d_thread = boost::thread(&fft_planner::preplan_thread, sizes);
+}
+
+/*! \brief Stop background planning.
+ *
+ * Waits for the plan currently being measured to finish.
+ */
+void fft_planner::stop(void)
+{
+    if (d_thread.joinable())
+    {
+        d_thread.interrupt();
+        d_thread.join();
+    }
+}
+
+void fft_planner::preplan_thread(std::vector<unsigned int> sizes)
+{
+    for (unsigned int i = 0; i < sizes.size(); i++)
+    {
+        if (boost::this_thread::interruption_requested())
+            return;
+
+        gr::fft::fft_complex *fft = new gr::fft::fft_complex(sizes[i], true);
+        delete fft;
+
+        save_wisdom();
+    }
+}
@@ -0,0 +1,58 @@
+/* -*- c++ -*- */
+/*
+ * Gqrx SDR: Software defined radio receiver powered by GNU Radio and Qt
+ *           http://gqrx.dk/
+ *
+ * Copyright 2011-2013 Alexandru Csete OZ9AEC.
+ *
+ * Gqrx is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Gqrx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Gqrx; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef FFT_PLANNER_H
+#define FFT_PLANNER_H
+
+#include <boost/thread/thread.hpp>
+#include <string>
+#include <vector>
+
+
+/*! \brief FFTW wisdom handling and background planning.
+ *  \ingroup DSP
+ *
+ * FFTW plans for large sizes take a long time to create. This class keeps
+ * the accumulated FFTW wisdom in a file in the gqrx configuration directory
+ * so that plans are only measured once, and can create plans for a list of
+ * sizes in a background thread so that the wisdom is available before the
+ * user selects one of them.
+ *
+ * All FFTW planner calls are serialized using the GNU Radio planner mutex.
+ */
+class fft_planner
+{
+public:
+    static void load_wisdom(const std::string &filename);
+    static void save_wisdom(void);
+
+    static void preplan(const std::vector<unsigned int> &sizes);
+    static void stop(void);
+
+private:
+    static void preplan_thread(std::vector<unsigned int> sizes);
+
+    static std::string      d_wisdom_file;  /*! File to save wisdom to. */
+    static boost::thread    d_thread;       /*! Background planner thread. */
+};
+
+#endif /* FFT_PLANNER_H */
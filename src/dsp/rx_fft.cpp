@@ -25,8 +25,66 @@
 #include <gnuradio/filter/firdes.h>
 #include <gnuradio/gr_complex.h>
 #include <gnuradio/fft/fft.h>
+#include <volk/volk.h>
+#include "dsp/fft_planner.h"
 #include "dsp/rx_fft.h"
 #include <algorithm>
+#include <cstring>
+#include <stdint.h>
+
+/* Conversion factor from log2 to dB: 10 * log10(2) */
+#define DB_PER_LOG2 3.01029995664f
+
+/* Tag added by gr-osmosdr sources to the first sample after a retune */
+static const pmt::pmt_t RX_FREQ_TAG = pmt::intern("rx_freq");
+
+/*! \brief Fast approximation of log2(x).
+ *
+ * Splits x into exponent and mantissa and approximates the logarithm of the
+ * mantissa with a rational function. The absolute error is below 1e-4, which
+ * is well below what can be seen on the plot. Unlike log10f() the loops using
+ * it can be vectorized by the compiler.
+ *
+ * \note Adapted from fastlog2() in fastapprox by Paul Mineiro.
+ */
+static inline float fast_log2(float x)
+{
+    uint32_t    bx;
+    uint32_t    bm;
+    float       m;
+
+    memcpy(&bx, &x, sizeof(bx));
+    bm = (bx & 0x007FFFFF) | 0x3F000000;
+    memcpy(&m, &bm, sizeof(m));
+
+    return (float)bx * 1.1920928955078125e-7f - 124.22551499f
+            - 1.498030302f * m - 1.72587999f / (0.3520887068f + m);
+}
+
+/*! \brief Convert power to dB.
+ *  \param in The power values.
+ *  \param out The dB values.
+ *  \param size The number of values.
+ *  \param scale Normalization applied to the power before conversion.
+ */
+static void power_to_db(const float *in, float *out, unsigned int size, float scale)
+{
+    for (unsigned int i = 0; i < size; i++)
+        out[i] = DB_PER_LOG2 * fast_log2(in[i] * scale + 1.0e-20f);
+}
+
+/*! \brief Convert power spectrum to dB and shift zero frequency to the center.
+ *
+ * The shift is done by writing the two halves to their final position
+ * instead of copying the spectrum.
+ */
+static void power_to_db_shifted(const float *in, float *out, unsigned int size, float scale)
+{
+    unsigned int half = size / 2;
+
+    power_to_db(in + half, out, size - half, scale);
+    power_to_db(in, out + size - half, half, scale);
+}
 
 
 rx_fft_c_sptr make_rx_fft_c (unsigned int fftsize, double quad_rate, int wintype)
@@ -45,23 +103,37 @@ rx_fft_c::rx_fft_c(unsigned int fftsize, double quad_rate, int wintype)
           gr::io_signature::make(0, 0, 0)),
       d_fftsize(fftsize),
       d_quadrate(quad_rate),
-      d_wintype(-1)
+      d_wintype(-1),
+      d_fftrate(25),
+      d_avg(0.25f),
+      d_plan_size(fftsize),
+      d_nthreads(1),
+      d_mt_size(MAX_FFT_SIZE),
+      d_fft_nthreads(1),
+      d_planning(false),
+      d_welch_n(0),
+      d_welch_ovr(0.5f),
+      d_zoom_decim(1),
+      d_zoom_center(0.0),
+      d_frame_center(0.0),
+      d_frame_bw(quad_rate),
+      d_restart_avg(false),
+      d_track(false)
 {
 
     /* create FFT object */
     d_fft = new gr::fft::fft_complex(d_fftsize, true);
 
-    /* allocate circular buffer */
-    d_cbuf.set_capacity(d_fftsize + d_quadrate);
-
-    /* create FFT window */
+    /* create buffers and FFT window */
     set_window_type(wintype);
-
-    d_lasttime = std::chrono::steady_clock::now();
+    set_params();
 }
 
 rx_fft_c::~rx_fft_c()
 {
+    if (d_plan_thread.joinable())
+        d_plan_thread.join();
+
     delete d_fft;
 }
 
@@ -70,123 +142,648 @@ rx_fft_c::~rx_fft_c()
  *  \param input_items
  *  \param output_items
  *
- * This method does nothing except throwing the incoming samples into the
- * circular buffer.
- * FFT is only executed when the GUI asks for new FFT data via get_fft_data().
+ * This method skips the samples that are not needed for the next frame and
+ * throws the remaining ones into the circular buffer. The FFT is computed
+ * when the buffer holds the last fftsize samples of a period or, in Welch
+ * mode, each time a segment is complete.
+ *
+ * Samples before the last "rx_freq" tag belong to the old frequency and
+ * are dropped.
  */
 int rx_fft_c::work(int noutput_items,
                    gr_vector_const_void_star &input_items,
                    gr_vector_void_star &output_items)
 {
-    int i;
     const gr_complex *in = (const gr_complex*)input_items[0];
+    unsigned long nitems = (unsigned long)noutput_items;
     (void) output_items;
 
-    /* just throw new samples into the buffer */
+    uint64_t start = nitems_read(0);
+    get_tags_in_range(d_tags, 0, start, start + nitems, RX_FREQ_TAG);
+
     boost::mutex::scoped_lock lock(d_mutex);
-    for (i = 0; i < noutput_items; i++)
+
+    // paused
+    if (d_fftrate <= 0)
+        return noutput_items;
+
+    if (!d_tags.empty())
     {
-        d_cbuf.push_back(in[i]);
+        unsigned long offset = (unsigned long)(d_tags.back().offset - start);
+
+        drop_frames();
+        in += offset;
+        nitems -= offset;
     }
 
+    if (d_zoom_decim > 1)
+        zoom_capture(in, nitems);
+    else
+        capture(in, nitems);
+
     return noutput_items;
 
 }
 
+/*! \brief Copy the samples needed for the next frames into the buffer.
+ *
+ * Note that this function does not lock the mutex since the caller, work()
+ * has already locked it.
+ */
+void rx_fft_c::capture(const gr_complex *in, unsigned long nitems)
+{
+    unsigned long i = 0;
+    unsigned long n;
+
+    while (i < nitems)
+    {
+        /* skip samples that will not end up in a frame */
+        if (d_skip > 0)
+        {
+            n = std::min(d_skip, nitems - i);
+            d_skip -= n;
+            i += n;
+            continue;
+        }
+
+        /* copy the tail of the period into the buffer */
+        n = std::min(d_left, nitems - i);
+        if (d_welch_n > 1)
+            n = std::min(n, d_hop_left);
+        d_cbuf.insert(d_cbuf.end(), in + i, in + i + n);
+        d_left -= n;
+        i += n;
+
+        if (d_welch_n > 1)
+        {
+            d_hop_left -= n;
+            if (d_hop_left == 0)
+            {
+                if (d_cbuf.full())
+                    fft_segment();
+                d_hop_left = d_welch_hop;
+            }
+        }
+
+        if (d_left == 0)
+        {
+            end_period();
+            start_period();
+        }
+    }
+}
+
+/*! \brief Translate and decimate the input before capturing it.
+ *
+ * The input is shifted by -d_zoom_center and low pass filtered with
+ * d_zoom_taps. Only every d_zoom_decim-th filter output is computed, and
+ * outputs that would be skipped by capture() are not computed at all.
+ *
+ * Note that this function does not lock the mutex since the caller, work()
+ * has already locked it.
+ */
+void rx_fft_c::zoom_capture(const gr_complex *in, unsigned long nitems)
+{
+    unsigned long ntaps = d_zoom_taps.size();
+    unsigned long pos = 0;
+    unsigned long avail;
+    unsigned long n;
+    unsigned long k;
+    size_t old = d_zoom_buf.size();
+
+    d_zoom_buf.resize(old + nitems);
+    volk_32fc_s32fc_x2_rotator_32fc(&d_zoom_buf[old], in, d_zoom_inc,
+                                    &d_zoom_phase, nitems);
+
+    while (pos + ntaps <= d_zoom_buf.size())
+    {
+        avail = (d_zoom_buf.size() - ntaps - pos) / d_zoom_decim + 1;
+
+        if (d_skip > 0)
+        {
+            n = std::min(d_skip, avail);
+            d_skip -= n;
+            pos += n * d_zoom_decim;
+            continue;
+        }
+
+        n = std::min(avail, (unsigned long)d_zoom_out.size());
+        for (k = 0; k < n; k++, pos += d_zoom_decim)
+            volk_32fc_32f_dot_prod_32fc(&d_zoom_out[k], &d_zoom_buf[pos],
+                                        d_zoom_taps.data(), ntaps);
+
+        capture(d_zoom_out.data(), n);
+    }
+
+    d_zoom_buf.erase(d_zoom_buf.begin(), d_zoom_buf.begin() + pos);
+}
+
 /*! \brief Get FFT data.
- *  \param fftPoints Buffer to copy FFT data
+ *  \param fftPoints Buffer to copy the latest frame to (dBFS).
+ *  \param avgPoints Buffer to copy the averaged frames to (dBFS).
  *  \param fftSize Current FFT size (output).
+ *  \param center Center of the band covered by the frames, relative to the
+ *                input center frequency (output).
+ *  \param bandwidth Bandwidth covered by the frames (output).
+ *
+ * The frames are already shifted so that the lowest frequency comes first.
  */
-void rx_fft_c::get_fft_data(std::complex<float>* fftPoints, unsigned int &fftSize)
+void rx_fft_c::get_fft_data(float* fftPoints, float* avgPoints, unsigned int &fftSize,
+                            double &center, double &bandwidth)
 {
-    boost::mutex::scoped_lock lock(d_mutex);
+    boost::mutex::scoped_lock lock(d_out_mutex);
 
-    if (d_cbuf.size() < d_fftsize)
+    if (!d_frame_valid)
     {
-        // not enough samples in the buffer
+        // no complete frame yet
         fftSize = 0;
 
         return;
     }
 
-    std::chrono::time_point<std::chrono::steady_clock> now = std::chrono::steady_clock::now();
-    std::chrono::duration<double> diff = now - d_lasttime;
-    d_lasttime = now;
+    // d_fftsize may already have changed while the buffers have not
+    memcpy(fftPoints, d_db.data(), sizeof(float)*d_db.size());
+    memcpy(avgPoints, d_db_avg.data(), sizeof(float)*d_db_avg.size());
+    fftSize = d_db.size();
+    center = d_frame_center;
+    bandwidth = d_frame_bw;
+}
 
-    /* perform FFT */
-    d_cbuf.erase_begin(std::min((unsigned int)(diff.count() * d_quadrate * 1.001), (unsigned int)d_cbuf.size() - d_fftsize));
-    do_fft(d_fftsize);
-    //d_cbuf.clear();
+/*! \brief Get the signals found in the averaged frames.
+ *  \param sigs The tracked signals (output). Their frequencies are relative
+ *              to the input center frequency like the center returned by
+ *              get_fft_data().
+ *
+ * The list is empty while tracking is disabled, see set_tracking().
+ */
+void rx_fft_c::get_signals(std::vector<tracked_signal> &sigs)
+{
+    boost::mutex::scoped_lock lock(d_out_mutex);
 
-    /* get FFT data */
-    memcpy(fftPoints, d_fft->get_outbuf(), sizeof(gr_complex)*d_fftsize);
-    fftSize = d_fftsize;
+    sigs = d_signals;
 }
 
-/*! \brief Compute FFT on the available input data.
- *  \param data_in The data to compute FFT on.
- *  \param size The size of data_in.
+/*! \brief Compute the FFT of the buffer and add its power to the average.
  *
- * Note that this function does not lock the mutex since the caller, get_fft_data()
- * has alrady locked it.
+ * Note that this function does not lock the mutex since the caller, work()
+ * has already locked it.
  */
-void rx_fft_c::do_fft(unsigned int size)
+void rx_fft_c::fft_segment()
 {
-    /* apply window, if any */
-    if (d_window.size())
+    gr_complex *dst = d_fft->get_inbuf();
+    unsigned int n1 = d_cbuf.array_one().second;
+    unsigned int n2 = d_cbuf.array_two().second;
+
+    /* apply window while linearizing the circular buffer */
+    volk_32fc_32f_multiply_32fc(dst, d_cbuf.array_one().first, d_window.data(), n1);
+    volk_32fc_32f_multiply_32fc(dst + n1, d_cbuf.array_two().first, d_window.data() + n1, n2);
+
+    d_fft->execute();
+
+    volk_32fc_magnitude_squared_32f(d_mag.data(), d_fft->get_outbuf(), d_fftsize);
+    volk_32f_x2_add_32f(d_psd_acc.data(), d_psd_acc.data(), d_mag.data(), d_fftsize);
+    d_nseg++;
+}
+
+/*! \brief Start a new frame period.
+ *
+ * Computes how many samples of the next period must be skipped and how many
+ * must be copied so that the buffer holds the last fftsize samples when
+ * the period ends. If the period is shorter than the FFT size consecutive
+ * frames overlap.
+ *
+ * In Welch mode the copied part is extended to cover all segments and the
+ * segments are aligned so that the last one ends with the period.
+ *
+ * Note that this function does not lock the mutex.
+ */
+void rx_fft_c::start_period()
+{
+    unsigned long required = d_fftsize;
+    double rate = d_quadrate / (double)d_zoom_decim;
+
+    if (d_fftrate > 0 && rate > 0.0)
+        d_period = std::max(1ul, (unsigned long)(rate / (double)d_fftrate));
+    else
+        d_period = d_fftsize;
+
+    if (d_welch_n > 1)
+        required += (d_welch_n - 1) * d_welch_hop;
+
+    if (d_period > required)
     {
-        gr_complex *dst = d_fft->get_inbuf();
-        for (unsigned int i = 0; i < size; i++)
-            dst[i] = d_cbuf[i] * d_window[i];
+        d_skip = d_period - required;
+        d_left = required;
+        d_hop_left = d_fftsize;
     }
     else
     {
-        memcpy(d_fft->get_inbuf(), d_cbuf.linearize(), sizeof(gr_complex)*size);
+        d_skip = 0;
+        d_left = d_period;
+        d_hop_left = ((d_period - 1) % d_welch_hop) + 1;
     }
+}
 
-    /* compute FFT */
-    d_fft->execute();
+/*! \brief Publish the frame collected during the current period.
+ *
+ * Converts the (averaged) power spectrum to dBFS and updates the averaging
+ * filter. The output lock is only held while the new frame is swapped in.
+ *
+ * If tracking is enabled the signal tracker is updated with the averaged
+ * frame after the output lock has been released; d_db_avg is only written
+ * with d_mutex held, which the caller holds. The new signal list is then
+ * published under the output lock.
+ *
+ * Note that this function does not lock d_mutex.
+ */
+void rx_fft_c::end_period()
+{
+    float *db;
+    float *avg;
+    float  gain;
+    double bandwidth;
+    bool   new_band = false;
+
+    if (d_welch_n < 2 && d_cbuf.full())
+        fft_segment();
+
+    if (d_nseg == 0)
+        return;
+
+    // NB: without cast to float the multiplication will overflow at 64k
+    power_to_db_shifted(d_psd_acc.data(), d_db_work.data(), d_fftsize,
+                        1.f / ((float)d_nseg * (float)d_fftsize * (float)d_fftsize));
+    std::fill(d_psd_acc.begin(), d_psd_acc.end(), 0.f);
+    d_nseg = 0;
+
+    {
+        boost::mutex::scoped_lock lock(d_out_mutex);
+
+        d_db.swap(d_db_work);
+        db = d_db.data();
+        avg = d_db_avg.data();
+
+        // restart averaging when the frame covers a new band
+        bandwidth = d_quadrate / (double)d_zoom_decim;
+        if (d_restart_avg || d_zoom_center != d_frame_center || bandwidth != d_frame_bw)
+        {
+            d_frame_center = d_zoom_center;
+            d_frame_bw = bandwidth;
+            d_restart_avg = false;
+            new_band = true;
+            gain = 1.f;
+        }
+        else
+        {
+            gain = d_avg;
+        }
+
+        for (unsigned int i = 0; i < d_fftsize; i++)
+            avg[i] += gain * (db[i] - avg[i]);
+
+        d_frame_valid = true;
+    }
+
+    if (!d_track)
+        return;
+
+    // signals tracked in another band are meaningless in this one
+    if (new_band)
+        d_tracker.reset();
+
+    d_tracker.update(d_db_avg.data(), d_db_avg.size(), d_frame_center, d_frame_bw);
+
+    boost::mutex::scoped_lock lock(d_out_mutex);
+    d_tracker.get_signals(d_signals);
 }
 
-/*! \brief Update circular buffer and FFT object. */
+/*! \brief Update circular buffer, output buffers and window.
+ *
+ * Note that this function does not lock d_mutex.
+ */
 void rx_fft_c::set_params()
 {
-    boost::mutex::scoped_lock lock(d_mutex);
-
     /* clear and resize circular buffer */
     d_cbuf.clear();
-    d_cbuf.set_capacity(d_fftsize + d_quadrate);
+    d_cbuf.set_capacity(d_fftsize);
+    d_psd_acc.assign(d_fftsize, 0.f);
+    d_mag.resize(d_fftsize);
+    d_db_work.resize(d_fftsize);
+    d_nseg = 0;
+    d_welch_hop = std::max(1ul, (unsigned long)(d_fftsize * (1.f - d_welch_ovr)));
+    reset_zoom();
+
+    /* reset output buffers */
+    {
+        boost::mutex::scoped_lock out_lock(d_out_mutex);
+        d_db.assign(d_fftsize, -140.f);
+        d_db_avg.assign(d_fftsize, -140.f);
+        d_frame_valid = false;
+        d_signals.clear();
+    }
+    d_tracker.reset();
 
-    /* reset window */
-    int wintype = d_wintype; // FIXME: would be nicer with a window_reset()
-    d_wintype = -1;
-    set_window_type(wintype);
+    make_window();
+}
 
-    /* reset FFT object (also reset FFTW plan) */
-    delete d_fft;
-    d_fft = new gr::fft::fft_complex (d_fftsize, true);
+/*! \brief Restart the zoom filter and the frame period.
+ *
+ * Designs the decimation filter for the current zoom settings and drops
+ * all samples collected so far, since they may belong to another band.
+ *
+ * Note that this function does not lock d_mutex.
+ */
+void rx_fft_c::reset_zoom()
+{
+    if (d_zoom_decim > 1)
+    {
+        // pass band +/- 0.4 * output rate, aliases stay outside of it
+        double out_rate = d_quadrate / (double)d_zoom_decim;
+
+        d_zoom_taps = gr::filter::firdes::low_pass(1.0, d_quadrate, 0.5 * out_rate,
+                                                   0.2 * out_rate,
+                                                   gr::filter::firdes::WIN_BLACKMAN);
+        d_zoom_inc = std::polar(1.f, (float)(-2.0 * M_PI * d_zoom_center / d_quadrate));
+        d_zoom_out.resize(4096);
+    }
+    else
+    {
+        d_zoom_taps.clear();
+        d_zoom_out.clear();
+    }
+
+    restart();
 }
 
-/*! \brief Set new FFT size. */
-void rx_fft_c::set_fft_size(unsigned int fftsize)
+/*! \brief Drop the samples collected so far and start a new period.
+ *
+ * Note that this function does not lock d_mutex.
+ */
+void rx_fft_c::restart()
+{
+    d_zoom_phase = gr_complex(1.f, 0.f);
+    d_zoom_buf.clear();
+
+    d_cbuf.clear();
+    std::fill(d_psd_acc.begin(), d_psd_acc.end(), 0.f);
+    d_nseg = 0;
+    start_period();
+}
+
+/*! \brief The input has been retuned.
+ *
+ * Drops the samples collected for the current frame and invalidates the
+ * last frame, so get_fft_data() returns nothing until a frame of the new
+ * frequency is ready. That frame restarts the average.
+ *
+ * Use this when the source does not tag the stream after a retune.
+ * Samples still buffered upstream mostly fall into the part of the first
+ * period that is skipped.
+ */
+void rx_fft_c::retune()
+{
+    boost::mutex::scoped_lock lock(d_mutex);
+    drop_frames();
+}
+
+/*! \brief Forget the current and the last frame after a retune.
+ *
+ * Note that this function does not lock d_mutex.
+ */
+void rx_fft_c::drop_frames()
+{
+    restart();
+    d_restart_avg = true;
+
+    boost::mutex::scoped_lock out_lock(d_out_mutex);
+    d_frame_valid = false;
+    d_signals.clear();
+}
+
+/*! \brief Create FFT plans for the requested size and thread count.
+ *
+ * Runs in d_plan_thread. FFTW planning is done without holding d_mutex so
+ * that work() can continue with the old plan. If the requested size or
+ * thread count changes while planning the new plan is discarded and the
+ * loop starts over.
+ */
+void rx_fft_c::plan_thread()
 {
-    if (fftsize != d_fftsize)
+    unsigned int            size;
+    int                     nthreads;
+    gr::fft::fft_complex   *fft;
+
+    for (;;)
     {
-        d_fftsize = fftsize;
-        set_params();
+        {
+            boost::mutex::scoped_lock lock(d_mutex);
+
+            size = d_plan_size;
+            nthreads = threads_for(size);
+            if (size == d_fftsize && nthreads == d_fft_nthreads)
+            {
+                d_planning = false;
+                return;
+            }
+        }
+
+        fft = new gr::fft::fft_complex(size, true, nthreads);
+        fft_planner::save_wisdom();
+
+        boost::mutex::scoped_lock lock(d_mutex);
+
+        if (size == d_plan_size && nthreads == threads_for(size))
+        {
+            delete d_fft;
+            d_fft = fft;
+            d_fft_nthreads = nthreads;
+            if (size != d_fftsize)
+            {
+                d_fftsize = size;
+                set_params();
+            }
+            d_planning = false;
+            return;
+        }
+
+        delete fft;
     }
+}
+
+/*! \brief Start the planner thread unless it is already running.
+ *
+ * Note that this function does not lock d_mutex.
+ */
+void rx_fft_c::start_planner()
+{
+    if (d_planning)
+        return;
+
+    // previous planner thread has already left the loop
+    if (d_plan_thread.joinable())
+        d_plan_thread.join();
+
+    d_planning = true;
+    d_plan_thread = boost::thread(&rx_fft_c::plan_thread, this);
+}
+
+/*! \brief Number of FFTW threads to use for a given FFT size. */
+int rx_fft_c::threads_for(unsigned int size) const
+{
+    return (size >= d_mt_size) ? d_nthreads : 1;
+}
+
+/*! \brief Set new FFT size.
+ *
+ * The new FFT object is created in the background. get_fft_size() returns
+ * the old size until the new plan is in use.
+ */
+void rx_fft_c::set_fft_size(unsigned int fftsize)
+{
+    boost::mutex::scoped_lock lock(d_mutex);
 
+    d_plan_size = fftsize;
+    if (fftsize != d_fftsize || threads_for(fftsize) != d_fft_nthreads)
+        start_planner();
+}
+
+/*! \brief Use multiple threads for large FFTs.
+ *  \param nthreads The number of FFTW threads.
+ *  \param min_size FFTs with fewer points use a single thread.
+ *
+ * A single FFTW execute on one core limits the frame rate for FFT sizes in
+ * the 512k - 1M range. Smaller FFTs are faster in one thread.
+ */
+void rx_fft_c::set_fft_threads(int nthreads, unsigned int min_size)
+{
+    boost::mutex::scoped_lock lock(d_mutex);
+
+    d_nthreads = std::max(1, nthreads);
+    d_mt_size = min_size;
+    if (threads_for(d_plan_size) != d_fft_nthreads || d_plan_size != d_fftsize)
+        start_planner();
 }
 
 /*! \brief Set new quadrature rate. */
 void rx_fft_c::set_quad_rate(double quad_rate)
 {
+    boost::mutex::scoped_lock lock(d_mutex);
+
     if (quad_rate != d_quadrate) {
         d_quadrate = quad_rate;
+        d_zoom_decim = 1;
+        d_zoom_center = 0.0;
         set_params();
     }
 }
 
+/*! \brief Select the band shown by the GUI.
+ *  \param center Center of the shown span relative to the input center.
+ *  \param span The shown span in Hz. 0 disables the zoom mode.
+ *
+ * Selects the largest decimation whose pass band still covers the span.
+ * The translation frequency is only changed when the span leaves the pass
+ * band, so that panning does not restart the frame for every pixel.
+ */
+void rx_fft_c::set_zoom(double center, double span)
+{
+    boost::mutex::scoped_lock lock(d_mutex);
+
+    unsigned int decim = 1;
+    double new_center = 0.0;
+
+    if (span > 0.0 && d_quadrate > 0.0)
+    {
+        while (decim < MAX_ZOOM_DECIM && 0.4 * d_quadrate / decim >= span)
+            decim *= 2;
+    }
+
+    if (decim > 1)
+    {
+        double pass = 0.4 * d_quadrate / decim;
+
+        if (decim == d_zoom_decim &&
+            std::abs(center - d_zoom_center) + span / 2.0 <= pass)
+            new_center = d_zoom_center;
+        else
+            new_center = center;
+    }
+
+    if (decim != d_zoom_decim || new_center != d_zoom_center)
+    {
+        d_zoom_decim = decim;
+        d_zoom_center = new_center;
+        reset_zoom();
+    }
+}
+
+/*! \brief Set the rate at which the GUI requests new frames.
+ *  \param fps The new frame rate. 0 pauses the FFT.
+ *
+ * Only the samples needed for one frame per period are copied, so the
+ * frame rate determines how much of the input is skipped. While paused
+ * no samples are captured and no frames are computed.
+ */
+void rx_fft_c::set_fft_rate(int fps)
+{
+    boost::mutex::scoped_lock lock(d_mutex);
+
+    if (fps != d_fftrate)
+    {
+        d_fftrate = fps;
+        restart();
+    }
+}
+
+/*! \brief Configure Welch averaging.
+ *  \param segments The number of segments to average per frame. Values
+ *                  below 2 disable Welch averaging.
+ *  \param overlap The overlap between consecutive segments (0.0 to 0.9).
+ */
+void rx_fft_c::set_welch(int segments, float overlap)
+{
+    boost::mutex::scoped_lock lock(d_mutex);
+
+    overlap = std::max(0.f, std::min(overlap, 0.9f));
+
+    if (segments != d_welch_n || overlap != d_welch_ovr)
+    {
+        d_welch_n = segments;
+        d_welch_ovr = overlap;
+        set_params();
+    }
+}
+
+/*! \brief Set gain of the averaging filter.
+ *  \param gain The new gain between 0.0 (hold) and 1.0 (no averaging).
+ */
+void rx_fft_c::set_averaging(float gain)
+{
+    boost::mutex::scoped_lock lock(d_out_mutex);
+
+    d_avg = gain;
+}
+
+/*! \brief Enable or disable the signal tracker.
+ *  \param enabled True to track signals in the averaged frames.
+ *
+ * Tracking costs a pass over every frame plus a sort in the DSP thread,
+ * so it should only be enabled while the signals are used.
+ */
+void rx_fft_c::set_tracking(bool enabled)
+{
+    boost::mutex::scoped_lock lock(d_mutex);
+
+    if (enabled == d_track)
+        return;
+
+    d_track = enabled;
+    d_tracker.reset();
+
+    boost::mutex::scoped_lock out_lock(d_out_mutex);
+    d_signals.clear();
+}
+
 /*! \brief Get currently used FFT size. */
 unsigned int rx_fft_c::get_fft_size() const
 {
@@ -196,6 +793,13 @@ unsigned int rx_fft_c::get_fft_size() const
 /*! \brief Set new window type. */
 void rx_fft_c::set_window_type(int wintype)
 {
+    if ((wintype < gr::filter::firdes::WIN_HAMMING) || (wintype > gr::filter::firdes::WIN_FLATTOP))
+    {
+        wintype = gr::filter::firdes::WIN_HAMMING;
+    }
+
+    boost::mutex::scoped_lock lock(d_mutex);
+
     if (wintype == d_wintype)
     {
         /* nothing to do */
@@ -203,14 +807,20 @@ void rx_fft_c::set_window_type(int wintype)
     }
 
     d_wintype = wintype;
+    make_window();
+}
 
-    if ((d_wintype < gr::filter::firdes::WIN_HAMMING) || (d_wintype > gr::filter::firdes::WIN_FLATTOP))
-    {
-        d_wintype = gr::filter::firdes::WIN_HAMMING;
-    }
+/*! \brief Create the window taps for the current type and FFT size.
+ *
+ * The window is used by work(), so this function must be called with
+ * d_mutex held.
+ */
+void rx_fft_c::make_window()
+{
+    std::vector<float> window = gr::filter::firdes::window(
+                (gr::filter::firdes::win_type)d_wintype, d_fftsize, 6.76);
 
-    d_window.clear();
-    d_window = gr::filter::firdes::window((gr::filter::firdes::win_type)d_wintype, d_fftsize, 6.76);
+    d_window.swap(window);
 }
 
 /*! \brief Get currently used window type. */
@@ -238,14 +848,17 @@ rx_fft_f::rx_fft_f(unsigned int fftsize, double audio_rate, int wintype)
           gr::io_signature::make(0, 0, 0)),
       d_fftsize(fftsize),
       d_audiorate(audio_rate),
-      d_wintype(-1)
+      d_wintype(-1),
+      d_plan_size(fftsize),
+      d_planning(false)
 {
 
     /* create FFT object */
-    d_fft = new gr::fft::fft_complex(d_fftsize, true);
+    d_fft = new gr::fft::fft_real_fwd(d_fftsize);
 
     /* allocate circular buffer */
     d_cbuf.set_capacity(d_fftsize + d_audiorate);
+    d_mag.resize(d_fftsize / 2 + 1);
 
     /* create FFT window */
     set_window_type(wintype);
@@ -253,6 +866,9 @@ rx_fft_f::rx_fft_f(unsigned int fftsize, double audio_rate, int wintype)
 
 rx_fft_f::~rx_fft_f()
 {
+    if (d_plan_thread.joinable())
+        d_plan_thread.join();
+
     delete d_fft;
 }
 
@@ -269,25 +885,21 @@ int rx_fft_f::work(int noutput_items,
                    gr_vector_const_void_star &input_items,
                    gr_vector_void_star &output_items)
 {
-    int i;
     const float *in = (const float*)input_items[0];
     (void) output_items;
 
     /* just throw new samples into the buffer */
     boost::mutex::scoped_lock lock(d_mutex);
-    for (i = 0; i < noutput_items; i++)
-    {
-        d_cbuf.push_back(in[i]);
-    }
+    d_cbuf.insert(d_cbuf.end(), in, in + noutput_items);
 
     return noutput_items;
 }
 
 /*! \brief Get FFT data.
- *  \param fftPoints Buffer to copy FFT data
+ *  \param fftPoints Buffer to copy the shifted power spectrum to (dBFS).
  *  \param fftSize Current FFT size (output).
  */
-void rx_fft_f::get_fft_data(std::complex<float>* fftPoints, unsigned int &fftSize)
+void rx_fft_f::get_fft_data(float* fftPoints, unsigned int &fftSize)
 {
     boost::mutex::scoped_lock lock(d_mutex);
 
@@ -308,8 +920,16 @@ void rx_fft_f::get_fft_data(std::complex<float>* fftPoints, unsigned int &fftSiz
     do_fft(d_fftsize);
     //d_cbuf.clear();
 
-    /* get FFT data */
-    memcpy(fftPoints, d_fft->get_outbuf(), sizeof(gr_complex)*d_fftsize);
+    /* get FFT data; bin 0 (DC) goes to the center of the shifted spectrum */
+    unsigned int half = d_fftsize / 2;
+    float scale = 1.f / ((float)d_fftsize * (float)d_fftsize);
+
+    volk_32fc_magnitude_squared_32f(d_mag.data(), d_fft->get_outbuf(), half + 1);
+    power_to_db(d_mag.data(), fftPoints + half, half, scale);
+    power_to_db(d_mag.data() + half, fftPoints, 1, scale);
+
+    /* the spectrum of a real signal is symmetric around DC */
+    std::reverse_copy(fftPoints + half + 1, fftPoints + d_fftsize, fftPoints + 1);
     fftSize = d_fftsize;
 }
 
@@ -322,19 +942,24 @@ void rx_fft_f::get_fft_data(std::complex<float>* fftPoints, unsigned int &fftSiz
  */
 void rx_fft_f::do_fft(unsigned int size)
 {
-    gr_complex *dst = d_fft->get_inbuf();
-    unsigned int i;
+    float *dst = d_fft->get_inbuf();
+    boost::circular_buffer<float>::array_range a1 = d_cbuf.array_one();
+    boost::circular_buffer<float>::array_range a2 = d_cbuf.array_two();
+    unsigned int n1 = std::min((unsigned int)a1.second, size);
+    unsigned int n2 = size - n1;
 
-    /* apply window, and convert to complex */
+    /* apply window to the oldest size samples */
     if (d_window.size())
     {
-        for (i = 0; i < size; i++)
-            dst[i] = d_cbuf[i] * d_window[i];
+        volk_32f_x2_multiply_32f(dst, a1.first, d_window.data(), n1);
+        if (n2)
+            volk_32f_x2_multiply_32f(dst + n1, a2.first, d_window.data() + n1, n2);
     }
     else
     {
-        for (i = 0; i < size; i++)
-            dst[i] = d_cbuf[i];
+        memcpy(dst, a1.first, n1 * sizeof(float));
+        if (n2)
+            memcpy(dst + n1, a2.first, n2 * sizeof(float));
     }
 
     /* compute FFT */
@@ -342,27 +967,75 @@ void rx_fft_f::do_fft(unsigned int size)
 }
 
 
-/*! \brief Set new FFT size. */
+/*! \brief Set new FFT size.
+ *
+ * The new FFT object is created in the background. get_fft_size() returns
+ * the old size until the new plan is in use.
+ */
 void rx_fft_f::set_fft_size(unsigned int fftsize)
 {
-    if (fftsize != d_fftsize)
+    boost::mutex::scoped_lock lock(d_mutex);
+
+    d_plan_size = fftsize;
+    if (fftsize == d_fftsize || d_planning)
+        return;
+
+    // previous planner thread has already left the loop
+    if (d_plan_thread.joinable())
+        d_plan_thread.join();
+
+    d_planning = true;
+    d_plan_thread = boost::thread(&rx_fft_f::plan_thread, this);
+}
+
+/*! \brief Create the FFT plan for the requested size.
+ *
+ * Runs in d_plan_thread. The plan is created without holding d_mutex so
+ * that get_fft_data() can continue with the old one. If the requested size
+ * changes while planning the new plan is discarded and the loop starts
+ * over.
+ */
+void rx_fft_f::plan_thread()
+{
+    unsigned int            size;
+    gr::fft::fft_real_fwd  *fft;
+
+    for (;;)
     {
+        {
+            boost::mutex::scoped_lock lock(d_mutex);
+
+            size = d_plan_size;
+            if (size == d_fftsize)
+            {
+                d_planning = false;
+                return;
+            }
+        }
+
+        fft = new gr::fft::fft_real_fwd(size);
+        fft_planner::save_wisdom();
+
         boost::mutex::scoped_lock lock(d_mutex);
 
-        d_fftsize = fftsize;
+        if (size == d_plan_size)
+        {
+            d_fftsize = size;
 
-        /* clear and resize circular buffer */
-        d_cbuf.clear();
-        d_cbuf.set_capacity(d_fftsize);
+            /* clear and resize circular buffer */
+            d_cbuf.clear();
+            d_cbuf.set_capacity(d_fftsize);
+            d_mag.resize(d_fftsize / 2 + 1);
+            make_window();
 
-        /* reset window */
-        int wintype = d_wintype; // FIXME: would be nicer with a window_reset()
-        d_wintype = -1;
-        set_window_type(wintype);
+            /* replace FFT object */
+            delete d_fft;
+            d_fft = fft;
+            d_planning = false;
+            return;
+        }
 
-        /* reset FFT object (also reset FFTW plan) */
-        delete d_fft;
-        d_fft = new gr::fft::fft_complex(d_fftsize, true);
+        delete fft;
     }
 }
 
@@ -375,6 +1048,13 @@ unsigned int rx_fft_f::get_fft_size() const
 /*! \brief Set new window type. */
 void rx_fft_f::set_window_type(int wintype)
 {
+    if ((wintype < gr::filter::firdes::WIN_HAMMING) || (wintype > gr::filter::firdes::WIN_FLATTOP))
+    {
+        wintype = gr::filter::firdes::WIN_HAMMING;
+    }
+
+    boost::mutex::scoped_lock lock(d_mutex);
+
     if (wintype == d_wintype)
     {
         /* nothing to do */
@@ -382,14 +1062,19 @@ void rx_fft_f::set_window_type(int wintype)
     }
 
     d_wintype = wintype;
+    make_window();
+}
 
-    if ((d_wintype < gr::filter::firdes::WIN_HAMMING) || (d_wintype > gr::filter::firdes::WIN_FLATTOP))
-    {
-        d_wintype = gr::filter::firdes::WIN_HAMMING;
-    }
+/*! \brief Create the window taps for the current type and FFT size.
+ *
+ * Note that this function does not lock d_mutex.
+ */
+void rx_fft_f::make_window()
+{
+    std::vector<float> window = gr::filter::firdes::window(
+                (gr::filter::firdes::win_type)d_wintype, d_fftsize, 6.76);
 
-    d_window.clear();
-    d_window = gr::filter::firdes::window((gr::filter::firdes::win_type)d_wintype, d_fftsize, 6.76);
+    d_window.swap(window);
 }
 
 /*! \brief Get currently used window type. */
@@ -28,11 +28,14 @@
 #include <gnuradio/filter/firdes.h>       /* contains enum win_type */
 #include <gnuradio/gr_complex.h>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/circular_buffer.hpp>
 #include <chrono>
+#include "dsp/signal_tracker.h"
 
 
 #define MAX_FFT_SIZE 1048576
+#define MAX_ZOOM_DECIM 256
 
 class rx_fft_c;
 class rx_fft_f;
@@ -57,10 +60,35 @@ rx_fft_c_sptr make_rx_fft_c(unsigned int fftsize=4096, double quad_rate=0, int w
  *
  * This block is used to compute the FFT of the received spectrum.
  *
- * The samples are collected in a cicular buffer with size FFT_SIZE.
- * When the GUI asks for a new set of FFT data via get_fft_data() an FFT
- * will be performed on the data stored in the circular buffer - assuming
- * of course that the buffer contains at least fftsize samples.
+ * The input stream is divided into frame periods of quad_rate / fft_rate
+ * samples. Only the last fftsize samples of each period are copied into a
+ * circular buffer of size fftsize; the rest are skipped. At the end of each
+ * period the FFT of the buffer is computed in work().
+ *
+ * In Welch mode the last part of each period is split into overlapping,
+ * windowed segments that are transformed as they become available. Their
+ * power is averaged in the linear domain.
+ *
+ * The power spectrum of each frame is converted to shifted dBFS and
+ * averaged, so get_fft_data() only copies ready-to-plot frames.
+ *
+ * When the FFT size changes the new FFTW plan is created in a separate
+ * thread. The old plan keeps serving frames until the new one is ready.
+ * FFTs with at least min_size points can use FFTW's threaded planner,
+ * see set_fft_threads().
+ *
+ * In zoom mode (see set_zoom()) the input is translated to the center of
+ * the displayed span and decimated by a power of two before it enters the
+ * circular buffer. An FFT of the same size then has a finer resolution
+ * in the zoomed span, like a decim times larger full band FFT. The frames
+ * returned by get_fft_data() cover the band reported along with them.
+ *
+ * After a retune, signalled by an "rx_freq" stream tag from the source or
+ * by a call to retune(), the samples collected so far are dropped and the
+ * average restarts with the first new frame.
+ *
+ * Optionally a signal_tracker follows the signals in the averaged frames,
+ * see set_tracking() and get_signals().
  *
  * \note Uses code from qtgui_sink_c
  */
@@ -78,30 +106,90 @@ public:
              gr_vector_const_void_star &input_items,
              gr_vector_void_star &output_items);
 
-    void get_fft_data(std::complex<float>* fftPoints, unsigned int &fftSize);
+    void get_fft_data(float* fftPoints, float* avgPoints, unsigned int &fftSize,
+                      double &center, double &bandwidth);
+    void get_signals(std::vector<tracked_signal> &sigs);
 
     void set_window_type(int wintype);
     int  get_window_type() const;
 
     void set_fft_size(unsigned int fftsize);
     void set_quad_rate(double quad_rate);
+    void set_fft_rate(int fps);
+    void set_welch(int segments, float overlap);
+    void set_averaging(float gain);
+    void set_fft_threads(int nthreads, unsigned int min_size);
+    void set_zoom(double center, double span);
+    void set_tracking(bool enabled);
+    void retune();
     unsigned int get_fft_size() const;
 
 private:
     unsigned int d_fftsize;   /*! Current FFT size. */
     double       d_quadrate;
     int          d_wintype;   /*! Current window type. */
+    int          d_fftrate;   /*! Frames per second requested by the GUI. */
+    float        d_avg;       /*! Gain of the averaging filter. */
 
-    boost::mutex d_mutex;  /*! Used to lock FFT output buffer. */
+    boost::mutex d_mutex;     /*! Used to lock sample buffer and FFT. */
+    boost::mutex d_out_mutex; /*! Used to lock FFT output buffer. */
 
     gr::fft::fft_complex    *d_fft;    /*! FFT object. */
     std::vector<float>  d_window; /*! FFT window taps. */
 
+    unsigned int    d_plan_size;    /*! Requested FFT size. */
+    int             d_nthreads;     /*! Threads for FFTs >= d_mt_size. */
+    unsigned int    d_mt_size;      /*! Minimum size of threaded FFTs. */
+    int             d_fft_nthreads; /*! Threads used by d_fft. */
+    bool            d_planning;     /*! Planner thread is running. */
+    boost::thread   d_plan_thread;  /*! Creates FFT plans for new sizes. */
+
     boost::circular_buffer<gr_complex> d_cbuf; /*! buffer to accumulate samples. */
-    std::chrono::time_point<std::chrono::steady_clock> d_lasttime;
+    bool            d_frame_valid;    /*! Output buffers contain a frame. */
+    unsigned long   d_period;  /*! Samples per frame period. */
+    unsigned long   d_skip;    /*! Samples left to skip in current period. */
+    unsigned long   d_left;    /*! Samples left to copy in current period. */
+
+    int             d_welch_n;     /*! Segments per Welch average (< 2 is off). */
+    float           d_welch_ovr;   /*! Overlap between Welch segments (0..1). */
+    unsigned long   d_welch_hop;   /*! Samples between Welch segments. */
+    unsigned long   d_hop_left;    /*! Samples left until next segment. */
+    int             d_nseg;        /*! Segments in d_psd_acc. */
+    std::vector<float> d_psd_acc;  /*! Accumulated segment power. */
+    std::vector<float> d_mag;      /*! Power of the last segment. */
+    std::vector<float> d_db_work;  /*! Frame being converted to dB. */
+    std::vector<float> d_db;       /*! Last frame in dBFS (shifted). */
+    std::vector<float> d_db_avg;   /*! Averaged frames in dBFS (shifted). */
+
+    unsigned int    d_zoom_decim;  /*! Zoom decimation (1 is off). */
+    double          d_zoom_center; /*! Offset of the zoomed band in Hz. */
+    gr_complex      d_zoom_phase;  /*! Phase of the translating oscillator. */
+    gr_complex      d_zoom_inc;    /*! Phase increment per input sample. */
+    std::vector<float>      d_zoom_taps; /*! Decimation filter taps. */
+    std::vector<gr_complex> d_zoom_buf;  /*! Translated samples not yet filtered. */
+    std::vector<gr_complex> d_zoom_out;  /*! Decimated samples. */
+    double          d_frame_center;    /*! Center of the band in d_db. */
+    double          d_frame_bw;        /*! Bandwidth of the band in d_db. */
+    bool            d_restart_avg;     /*! Next frame restarts the average. */
+    std::vector<gr::tag_t>  d_tags;    /*! Retune tags found in the input. */
+
+    bool            d_track;           /*! Track signals in d_db_avg. */
+    signal_tracker  d_tracker;         /*! Finds signals in d_db_avg. */
+    std::vector<tracked_signal> d_signals; /*! Signals published by d_tracker. */
 
-    void do_fft(unsigned int size);
     void set_params();
+    void make_window();
+    void reset_zoom();
+    void restart();
+    void drop_frames();
+    void capture(const gr_complex *in, unsigned long nitems);
+    void zoom_capture(const gr_complex *in, unsigned long nitems);
+    void start_period();
+    void end_period();
+    void fft_segment();
+    void plan_thread();
+    void start_planner();
+    int  threads_for(unsigned int size) const;
 
 };
 
@@ -126,7 +214,15 @@ rx_fft_f_sptr make_rx_fft_f(unsigned int fftsize=1024, double audio_rate=48000,
  * The samples are collected in a cicular buffer with size FFT_SIZE.
  * When the GUI asks for a new set of FFT data using get_fft_data() an FFT
  * will be performed on the data stored in the circular buffer - assuming
- * that the buffer contains at least fftsize samples.
+ * that the buffer contains at least fftsize samples. The result is returned
+ * as shifted power spectrum in dBFS.
+ *
+ * A real-to-complex FFT is used, which only computes the fftsize/2+1
+ * non-negative frequency bins. The negative half of the returned spectrum
+ * is its mirror image.
+ *
+ * Like in rx_fft_c the plan for a new FFT size is created in a separate
+ * thread, so the GUI thread does not wait for the FFTW planner.
  *
  * \note Uses code from qtgui_sink_f
  */
@@ -144,7 +240,7 @@ public:
              gr_vector_const_void_star &input_items,
              gr_vector_void_star &output_items);
 
-    void get_fft_data(std::complex<float>* fftPoints, unsigned int &fftSize);
+    void get_fft_data(float* fftPoints, unsigned int &fftSize);
 
     void set_window_type(int wintype);
     int  get_window_type() const;
@@ -159,13 +255,20 @@ private:
 
     boost::mutex d_mutex;  /*! Used to lock FFT output buffer. */
 
-    gr::fft::fft_complex    *d_fft;    /*! FFT object. */
+    gr::fft::fft_real_fwd   *d_fft;    /*! FFT object. */
     std::vector<float>  d_window; /*! FFT window taps. */
 
+    unsigned int    d_plan_size;    /*! Requested FFT size. */
+    bool            d_planning;     /*! Planner thread is running. */
+    boost::thread   d_plan_thread;  /*! Creates FFT plans for new sizes. */
+
     boost::circular_buffer<float> d_cbuf; /*! buffer to accumulate samples. */
+    std::vector<float>  d_mag;    /*! Power of the fftsize/2+1 bins of the last FFT. */
     std::chrono::time_point<std::chrono::steady_clock> d_lasttime;
 
     void do_fft(unsigned int size);
+    void make_window();
+    void plan_thread();
 
 };
 
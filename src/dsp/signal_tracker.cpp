@@ -0,0 +1,275 @@
+/* -*- c++ -*- */
+/*
+ * Gqrx SDR: Software defined radio receiver powered by GNU Radio and Qt
+ *           http://gqrx.dk/
+ *
+ * Copyright 2011-2020 Alexandru Csete OZ9AEC.
+ *
+ * Gqrx is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Gqrx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Gqrx; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#include <algorithm>
+#include <cmath>
+#include "dsp/signal_tracker.h"
+
+#define NOISE_FLOOR_POINTS  256     /* number of bins used for the noise floor */
+#define NOISE_FLOOR_ALPHA   0.1f    /* smoothing of the noise floor */
+#define FREQ_ALPHA          0.3     /* smoothing of the frequency */
+#define MATCH_BINS          2.0     /* max frequency change between frames */
+
+static bool freq_less(const tracked_signal &a, const tracked_signal &b)
+{
+    return a.frequency < b.frequency;
+}
+
+signal_tracker::signal_tracker()
+    : d_threshold(10.0),
+      d_min_hits(3),
+      d_max_misses(5),
+      d_noise_floor(0.0),
+      d_have_floor(false),
+      d_next_id(1)
+{
+}
+
+/*! \brief Set the detection threshold.
+ *  \param threshold The level above the noise floor in dB.
+ */
+void signal_tracker::set_threshold(float threshold)
+{
+    d_threshold = threshold;
+}
+
+/*! \brief Set the persistence of the tracked signals.
+ *  \param min_hits Number of frames a signal must be found in before it
+ *                  is reported.
+ *  \param max_misses Number of frames a signal may be missing before it
+ *                    is dropped.
+ */
+void signal_tracker::set_persistence(int min_hits, int max_misses)
+{
+    d_min_hits = std::max(min_hits, 1);
+    d_max_misses = std::max(max_misses, 0);
+}
+
+/*! \brief Forget all tracked signals and the noise floor. */
+void signal_tracker::reset(void)
+{
+    d_tracks.clear();
+    d_have_floor = false;
+}
+
+/*! \brief Process a new FFT frame.
+ *  \param fft The FFT data in dB, lowest frequency first.
+ *  \param size The number of FFT bins.
+ *  \param center The center frequency of the FFT in Hz.
+ *  \param bandwidth The bandwidth covered by the FFT in Hz.
+ */
+void signal_tracker::update(const float *fft, unsigned int size,
+                            double center, double bandwidth)
+{
+    unsigned int    i;
+
+    if (size < 3 || bandwidth <= 0.0)
+        return;
+
+    // noise floor: median of an evenly spaced subset of the bins
+    unsigned int step = std::max(size / NOISE_FLOOR_POINTS, 1u);
+
+    d_sample.clear();
+    for (i = 0; i < size; i += step)
+        d_sample.push_back(fft[i]);
+    std::nth_element(d_sample.begin(), d_sample.begin() + d_sample.size() / 2,
+                     d_sample.end());
+
+    float median = d_sample[d_sample.size() / 2];
+    if (d_have_floor)
+        d_noise_floor += NOISE_FLOOR_ALPHA * (median - d_noise_floor);
+    else
+        d_noise_floor = median;
+    d_have_floor = true;
+
+    detect(fft, size, center, bandwidth);
+    match(MATCH_BINS * bandwidth / size);
+}
+
+/*! \brief Find the groups of bins above the threshold. */
+void signal_tracker::detect(const float *fft, unsigned int size,
+                            double center, double bandwidth)
+{
+    double          hz_per_bin = bandwidth / size;
+    float           level = d_noise_floor + d_threshold;
+    unsigned int    i, start = 0, peak = 0;
+    bool            in_signal = false;
+
+    d_found.clear();
+    for (i = 0; i <= size; i++)
+    {
+        bool above = (i < size) && (fft[i] > level);
+
+        if (above && !in_signal)
+        {
+            in_signal = true;
+            start = peak = i;
+        }
+        else if (above)
+        {
+            if (fft[i] > fft[peak])
+                peak = i;
+        }
+        else if (in_signal)
+        {
+            tracked_signal  sig;
+            double          delta = 0.0;
+            float           peak_level = fft[peak];
+
+            in_signal = false;
+
+            // parabolic interpolation of the peak
+            if (peak > 0 && peak < size - 1)
+            {
+                float a = fft[peak - 1];
+                float b = fft[peak];
+                float c = fft[peak + 1];
+                float denom = a - 2.f * b + c;
+
+                if (denom < 0.f)
+                {
+                    delta = 0.5 * (a - c) / denom;
+                    delta = std::max(-0.5, std::min(0.5, delta));
+                    peak_level = b - 0.25f * (a - c) * delta;
+                }
+            }
+
+            sig.id = 0;
+            sig.frequency = center + (peak + delta - size / 2.0) * hz_per_bin;
+            sig.bandwidth = (i - start) * hz_per_bin;
+            sig.level = peak_level;
+            sig.snr = peak_level - d_noise_floor;
+            sig.hits = 1;
+            sig.misses = 0;
+            d_found.push_back(sig);
+        }
+    }
+}
+
+/*! \brief Match the signals found in this frame to the tracked ones. */
+void signal_tracker::match(double max_dist)
+{
+    std::vector<tracked_signal>::iterator   it;
+    size_t      i, num_tracks = d_tracks.size();
+
+    d_matched.assign(num_tracks, false);
+
+    // both lists are sorted by frequency
+    for (i = 0; i < d_found.size(); i++)
+    {
+        tracked_signal &sig = d_found[i];
+
+        it = std::lower_bound(d_tracks.begin(), d_tracks.begin() + num_tracks,
+                              sig, freq_less);
+
+        // nearest unmatched neighbour within reach
+        long    best = -1;
+        double  best_dist = 0.0;
+        long    k = it - d_tracks.begin();
+        long    cand[2] = { k - 1, k };
+
+        for (int c = 0; c < 2; c++)
+        {
+            long j = cand[c];
+
+            if (j < 0 || j >= (long)num_tracks || d_matched[j])
+                continue;
+
+            double dist = std::fabs(d_tracks[j].frequency - sig.frequency);
+            double reach = std::max(max_dist, d_tracks[j].bandwidth / 2.0);
+
+            if (dist <= reach && (best < 0 || dist < best_dist))
+            {
+                best = j;
+                best_dist = dist;
+            }
+        }
+
+        if (best >= 0)
+        {
+            tracked_signal &track = d_tracks[best];
+
+            track.frequency += FREQ_ALPHA * (sig.frequency - track.frequency);
+            track.bandwidth = sig.bandwidth;
+            track.level = sig.level;
+            track.snr = sig.snr;
+            track.hits++;
+            track.misses = 0;
+            d_matched[best] = true;
+        }
+        else
+        {
+            sig.id = d_next_id++;
+            d_tracks.push_back(sig);
+        }
+    }
+
+    // age the tracks that were not found in this frame
+    for (i = 0; i < num_tracks; i++)
+        if (!d_matched[i])
+            d_tracks[i].misses++;
+
+    int max_misses = d_max_misses;
+    d_tracks.erase(std::remove_if(d_tracks.begin(), d_tracks.end(),
+                                  [max_misses](const tracked_signal &t)
+                                  { return t.misses > max_misses; }),
+                   d_tracks.end());
+
+    // new tracks were appended, the list is almost sorted
+    std::sort(d_tracks.begin(), d_tracks.end(), freq_less);
+}
+
+/*! \brief Get the confirmed signals sorted by frequency. */
+void signal_tracker::get_signals(std::vector<tracked_signal> &sigs) const
+{
+    sigs.clear();
+    for (size_t i = 0; i < d_tracks.size(); i++)
+        if (d_tracks[i].hits >= d_min_hits)
+            sigs.push_back(d_tracks[i]);
+}
+
+/*! \brief Find the confirmed signal nearest to a frequency.
+ *  \param freq The frequency in Hz.
+ *  \param max_dist The maximum distance from freq in Hz.
+ *  \param sig The signal found.
+ *  \returns True if a signal has been found.
+ */
+bool signal_tracker::find_nearest(double freq, double max_dist,
+                                  tracked_signal &sig) const
+{
+    bool    found = false;
+
+    for (size_t i = 0; i < d_tracks.size(); i++)
+    {
+        const tracked_signal &t = d_tracks[i];
+        double dist = std::fabs(t.frequency - freq);
+
+        if (t.hits >= d_min_hits && dist <= max_dist)
+        {
+            sig = t;
+            max_dist = dist;
+            found = true;
+        }
+    }
+
+    return found;
+}
@@ -0,0 +1,92 @@
+/* -*- c++ -*- */
+/*
+ * Gqrx SDR: Software defined radio receiver powered by GNU Radio and Qt
+ *           http://gqrx.dk/
+ *
+ * Copyright 2011-2020 Alexandru Csete OZ9AEC.
+ *
+ * Gqrx is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Gqrx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Gqrx; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef SIGNAL_TRACKER_H
+#define SIGNAL_TRACKER_H
+
+#include <vector>
+
+
+/*! \brief A signal found by the signal tracker. */
+struct tracked_signal
+{
+    unsigned int    id;         /*! Unique id, kept while the signal is tracked. */
+    double          frequency;  /*! Center frequency in Hz. */
+    double          bandwidth;  /*! Bandwidth above the threshold in Hz. */
+    float           level;      /*! Peak level in dB. */
+    float           snr;        /*! Peak level above the noise floor in dB. */
+    int             hits;       /*! Number of frames the signal was found in. */
+    int             misses;     /*! Frames since the signal was last found. */
+};
+
+/*! \brief Find and track signals in FFT frames.
+ *  \ingroup DSP
+ *
+ * Each FFT frame is searched for groups of bins above the noise floor plus
+ * a threshold. The peak of a group is located with sub-bin resolution using
+ * parabolic interpolation. Signals found in consecutive frames are matched
+ * against the already tracked ones, so a signal keeps its id while it is
+ * present. A signal is reported after it has been found in min_hits frames
+ * and dropped after it has been missing for more than max_misses frames.
+ *
+ * The noise floor is the median of a subset of the bins, smoothed over
+ * frames. All buffers are reused so an update does not allocate memory
+ * once the tracker has seen the largest FFT size.
+ *
+ * The tracker is not thread safe. rx_fft_c runs it in the DSP thread on
+ * its averaged frames and publishes the signals under its output lock.
+ */
+class signal_tracker
+{
+public:
+    signal_tracker();
+
+    void set_threshold(float threshold);
+    void set_persistence(int min_hits, int max_misses);
+    void reset(void);
+
+    void update(const float *fft, unsigned int size,
+                double center, double bandwidth);
+
+    void get_signals(std::vector<tracked_signal> &sigs) const;
+    bool find_nearest(double freq, double max_dist, tracked_signal &sig) const;
+    float noise_floor(void) const { return d_noise_floor; }
+
+private:
+    void detect(const float *fft, unsigned int size,
+                double center, double bandwidth);
+    void match(double max_dist);
+
+    float       d_threshold;    /*! Detection threshold above the noise floor in dB. */
+    int         d_min_hits;
+    int         d_max_misses;
+    float       d_noise_floor;  /*! Smoothed noise floor in dB. */
+    bool        d_have_floor;
+    unsigned int    d_next_id;
+
+    std::vector<tracked_signal> d_tracks;   /*! Tracked signals sorted by frequency. */
+    std::vector<tracked_signal> d_found;    /*! Signals found in the current frame. */
+    std::vector<bool>           d_matched;  /*! Tracks matched in the current frame. */
+    std::vector<float>          d_sample;   /*! Bins used for the noise floor. */
+};
+
+#endif /* SIGNAL_TRACKER_H */
@@ -25,8 +25,11 @@
 #include <QStringList>
 #include <QTextStream>
 #include <QString>
+#include <QHash>
+#include <QSaveFile>
 #include <QSet>
 #include <algorithm>
+#include <cstring>
 #include "bookmarks.h"
 #include <stdio.h>
 #include <wchar.h>
@@ -36,9 +39,17 @@ const QString TagInfo::strUntagged("Untagged");
 Bookmarks* Bookmarks::m_pThis = 0;
 
 Bookmarks::Bookmarks()
+    : m_Writer(new BookmarksWriter),
+      m_SavePending(false),
+      m_JournalSize(0),
+      m_IndexValid(false),
+      m_MaxBandwidth(0)
 {
      TagInfo tag(TagInfo::strUntagged);
      m_TagList.append(tag);
+     m_TagIndex.insert(tag.name, 0);
+
+     connect(m_Writer, SIGNAL(finished()), this, SLOT(onWriterFinished()));
 }
 
 void Bookmarks::create()
@@ -59,177 +70,631 @@ void Bookmarks::setConfigDir(const QString& cfg_dir)
 
 void Bookmarks::add(BookmarkInfo &info)
 {
-    m_BookmarkList.append(info);
-    std::stable_sort(m_BookmarkList.begin(),m_BookmarkList.end());
-    save();
+    // insert after bookmarks with the same frequency, like a stable sort
+    QList<BookmarkInfo>::iterator it = std::upper_bound(m_BookmarkList.begin(),
+                                                        m_BookmarkList.end(),
+                                                        info);
+    int index = it - m_BookmarkList.begin();
+    m_BookmarkList.insert(index, info);
+    invalidateIndex();
+    writeJournal('+', info);
+    emit BookmarkAdded(index);
     emit( BookmarksChanged() );
 }
 
 void Bookmarks::remove(int index)
 {
+    writeJournal('-', m_BookmarkList[index]);
     m_BookmarkList.removeAt(index);
-    save();
+    invalidateIndex();
+    emit BookmarkRemoved(index);
+    emit BookmarksChanged();
+}
+
+/** Change the frequency of a bookmark, which moves it to a new index. */
+void Bookmarks::setFrequency(int index, qint64 frequency)
+{
+    BookmarkInfo info = m_BookmarkList[index];
+
+    remove(index);
+    info.frequency = frequency;
+    add(info);
+}
+
+/**
+ * Replace a bookmark after it has been edited, e.g. its name or tags.
+ * The edit is journaled as the removal of the old bookmark followed by
+ * the addition of the new one.
+ */
+void Bookmarks::setBookmark(int index, const BookmarkInfo &info)
+{
+    if (info.frequency != m_BookmarkList[index].frequency)
+    {
+        BookmarkInfo moved = info;
+
+        remove(index);
+        add(moved);
+        return;
+    }
+
+    writeJournal('-', m_BookmarkList[index]);
+    m_BookmarkList[index] = info;
+    invalidateIndex();
+    writeJournal('+', info);
+    emit BookmarkChanged(index);
     emit BookmarksChanged();
 }
 
+// Remove white space at both ends of [b, e).
+static inline void trimRange(const char *&b, const char *&e)
+{
+    while (b < e && (*b == ' ' || *b == '\t' || *b == '\r'))
+        b++;
+    while (e > b && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r'))
+        e--;
+}
+
+// Integer value of [b, e), 0 if it is not a number (like QString::toLongLong).
+static qint64 parseInteger(const char *b, const char *e)
+{
+    qint64  value = 0;
+    bool    negative = false;
+
+    trimRange(b, e);
+    if (b < e && (*b == '-' || *b == '+'))
+        negative = (*b++ == '-');
+    if (b == e)
+        return 0;
+    for (; b < e; b++)
+    {
+        if (*b < '0' || *b > '9')
+            return 0;
+        value = value * 10 + (*b - '0');
+    }
+    return negative ? -value : value;
+}
+
+// Split a line at the semicolons. Returns the number of fields, which may be
+// larger than max_fields; only the first max_fields are stored.
+static int splitFields(const char *b, const char *e, int max_fields,
+                       const char **fb, const char **fe)
+{
+    int n = 0;
+
+    for (;;)
+    {
+        const char *sc = (const char *)memchr(b, ';', e - b);
+        const char *end = sc ? sc : e;
+
+        if (n < max_fields)
+        {
+            fb[n] = b;
+            fe[n] = end;
+            trimRange(fb[n], fe[n]);
+        }
+        n++;
+        if (!sc)
+            return n;
+        b = sc + 1;
+    }
+}
+
+/**
+ * Load the bookmarks file.
+ *
+ * The file is memory mapped and parsed in place. Tags and modulations are
+ * looked up in hash tables keyed by the raw bytes, so the only strings
+ * created per bookmark are its name and, the first time a value is seen,
+ * the modulation and tags.
+ */
 bool Bookmarks::load()
 {
     QFile file(m_bookmarksFile);
-    if (file.open(QIODevice::ReadOnly | QIODevice::Text))
+    if (file.open(QIODevice::ReadOnly))
     {
         m_BookmarkList.clear();
         m_TagList.clear();
+        m_TagIndex.clear();
 
         // always create the "Untagged" entry.
         findOrAddTag(TagInfo::strUntagged);
 
-        // Read Tags, until first empty line.
-        while (!file.atEnd())
+        QByteArray  buffer;
+        const char *data = 0;
+        qint64      size = file.size();
+
+        if (size > 0)
+            data = (const char *)file.map(0, size);
+        if (!data)
         {
-            QString line = QString::fromUtf8(file.readLine().trimmed());
+            buffer = file.readAll();
+            data = buffer.constData();
+            size = buffer.size();
+        }
 
-            if(line.isEmpty())
-                break;
+        QHash<QByteArray, TagInfo*> tags;
+        QHash<QByteArray, QString>  modulations;
+        const char *fb[5], *fe[5];
+        const char *p = data;
+        const char *end = data + size;
+        bool        inTags = true;
 
-            if(line.startsWith("#"))
-                continue;
+        while (p < end)
+        {
+            const char *eol = (const char *)memchr(p, '\n', end - p);
+            const char *b = p;
+            const char *e = eol ? eol : end;
 
-            QStringList strings = line.split(";");
-            if(strings.count() == 2)
-            {
-                TagInfo &info = findOrAddTag(strings[0]);
-                info.color = QColor(strings[1].trimmed());
-            }
-            else
+            p = e + 1;
+            trimRange(b, e);
+
+            // Read Tags, until first empty line. Read Bookmarks after it.
+            if (b == e)
             {
-                printf("\nBookmarks: Ignoring Line:\n  %s\n", line.toLatin1().data());
+                if (inTags)
+                {
+                    inTags = false;
+                    std::sort(m_TagList.begin(),m_TagList.end());
+                    rebuildTagIndex();
+                }
+                continue;
             }
-        }
-        std::sort(m_TagList.begin(),m_TagList.end());
 
-        // Read Bookmarks, after first empty line.
-        while (!file.atEnd())
-        {
-            QString line = QString::fromUtf8(file.readLine().trimmed());
-            if(line.isEmpty() || line.startsWith("#"))
+            if (*b == '#')
                 continue;
 
-            QStringList strings = line.split(";");
-            if(strings.count() == 5)
+            int n = splitFields(b, e, 5, fb, fe);
+
+            if (inTags && n == 2)
+            {
+                TagInfo &info = findOrAddTag(QString::fromUtf8(fb[0], fe[0] - fb[0]));
+                info.color = QColor(QString::fromLatin1(fb[1], fe[1] - fb[1]));
+            }
+            else if (!inTags && n == 5)
             {
                 BookmarkInfo info;
-                info.frequency  = strings[0].toLongLong();
-                info.name       = strings[1].trimmed();
-                info.modulation = strings[2].trimmed();
-                info.bandwidth  = strings[3].toInt();
+                info.frequency  = parseInteger(fb[0], fe[0]);
+                info.name       = QString::fromUtf8(fb[1], fe[1] - fb[1]);
+                info.bandwidth  = (int)parseInteger(fb[3], fe[3]);
+
+                // fromRawData() does not copy, the keys only live for the lookup
+                QByteArray key = QByteArray::fromRawData(fb[2], fe[2] - fb[2]);
+                QHash<QByteArray, QString>::const_iterator mod = modulations.constFind(key);
+                if (mod == modulations.constEnd())
+                    mod = modulations.insert(QByteArray(fb[2], fe[2] - fb[2]),
+                                             QString::fromUtf8(fb[2], fe[2] - fb[2]));
+                info.modulation = mod.value();
+
                 // Multiple Tags may be separated by comma.
-                QString strTags = strings[4];
-                QStringList TagList = strTags.split(",");
-                for(int iTag=0; iTag<TagList.size(); ++iTag)
+                const char *t = fb[4];
+                for (;;)
                 {
-                  info.tags.append(&findOrAddTag(TagList[iTag].trimmed()));
+                    const char *comma = (const char *)memchr(t, ',', fe[4] - t);
+                    const char *tb = t;
+                    const char *te = comma ? comma : fe[4];
+
+                    trimRange(tb, te);
+                    key = QByteArray::fromRawData(tb, te - tb);
+                    QHash<QByteArray, TagInfo*>::const_iterator tag = tags.constFind(key);
+                    if (tag == tags.constEnd())
+                        tag = tags.insert(QByteArray(tb, te - tb),
+                                          &findOrAddTag(QString::fromUtf8(tb, te - tb)));
+                    info.tags.append(tag.value());
+
+                    if (!comma)
+                        break;
+                    t = comma + 1;
                 }
 
                 m_BookmarkList.append(info);
             }
             else
             {
-                printf("\nBookmarks: Ignoring Line:\n  %s\n", line.toLatin1().data());
+                printf("\nBookmarks: Ignoring Line:\n  %s\n",
+                       QByteArray(b, e - b).constData());
             }
         }
         file.close();
-        std::stable_sort(m_BookmarkList.begin(),m_BookmarkList.end());
 
+        if (inTags)
+        {
+            std::sort(m_TagList.begin(),m_TagList.end());
+            rebuildTagIndex();
+        }
+
+        // the file is written sorted, only sort if it has been edited by hand
+        if (!std::is_sorted(m_BookmarkList.begin(), m_BookmarkList.end()))
+            std::stable_sort(m_BookmarkList.begin(),m_BookmarkList.end());
+        invalidateIndex();
+
+        // Edits that have not been compacted into the file yet.
+        m_JournalSize = 0;
+        int replayed = replayJournal(m_bookmarksFile + ".journal.old") +
+                       replayJournal(m_bookmarksFile + ".journal");
+        if (replayed > 0 || m_JournalSize >= BOOKMARKS_JOURNAL_MAX)
+            save();
+
+        emit BookmarksChanged();
+        return true;
+    }
+
+    // No file yet, but there may be edits in the journal.
+    m_JournalSize = 0;
+    if (replayJournal(m_bookmarksFile + ".journal.old") +
+        replayJournal(m_bookmarksFile + ".journal") > 0)
+    {
+        save();
         emit BookmarksChanged();
         return true;
     }
     return false;
 }
 
-//FIXME: Commas in names
-bool Bookmarks::save()
+/**
+ * Fill info from the fields of a bookmark line.
+ * Returns false if the number of fields is wrong.
+ */
+bool Bookmarks::parseBookmark(const QStringList &strings, BookmarkInfo &info)
 {
-    QFile file(m_bookmarksFile);
-    if(file.open(QFile::WriteOnly | QFile::Truncate | QIODevice::Text))
+    if (strings.count() != 5)
+        return false;
+
+    info.frequency  = strings[0].toLongLong();
+    info.name       = strings[1].trimmed();
+    info.modulation = strings[2].trimmed();
+    info.bandwidth  = strings[3].toInt();
+    // Multiple Tags may be separated by comma.
+    QString strTags = strings[4];
+    QStringList TagList = strTags.split(",");
+    for(int iTag=0; iTag<TagList.size(); ++iTag)
     {
-        QTextStream stream(&file);
+      info.tags.append(&findOrAddTag(TagList[iTag].trimmed()));
+    }
+    return true;
+}
 
-        stream << QString("# Tag name").leftJustified(20) + "; " +
-                  QString(" color") << endl;
+/** Format a bookmark line with the given tag names. */
+static QString formatBookmark(const BookmarkInfo &info, const QStringList &tags)
+{
+    return QString::number(info.frequency).rightJustified(12) +
+            "; " + info.name.leftJustified(25) + "; " +
+            info.modulation.leftJustified(20)+ "; " +
+            QString::number(info.bandwidth).rightJustified(10) + "; " +
+            tags.join(",");
+}
 
-        QSet<TagInfo*> usedTags;
-        for (int iBookmark = 0; iBookmark < m_BookmarkList.size(); iBookmark++)
-        {
-            BookmarkInfo& info = m_BookmarkList[iBookmark];
-            for(int iTag = 0; iTag < info.tags.size(); ++iTag)
-            {
-              TagInfo& tag = *info.tags[iTag];
-              usedTags.insert(&tag);
-            }
-        }
+/**
+ * Append an edit to the journal. Each line is '+' (added) or '-' (removed)
+ * followed by the bookmark in the CSV format.
+ */
+void Bookmarks::writeJournal(char op, const BookmarkInfo &info)
+{
+    QFile file(m_bookmarksFile + ".journal");
+    if (!file.open(QFile::WriteOnly | QFile::Append | QIODevice::Text))
+    {
+        // keep the edit anyway
+        save();
+        return;
+    }
+
+    QStringList tags;
+    for (int iTag = 0; iTag < info.tags.size(); ++iTag)
+        tags.append(info.tags[iTag]->name);
+
+    QTextStream stream(&file);
+    stream << op << "; " << formatBookmark(info, tags) << endl;
+    file.close();
 
-        for (QSet<TagInfo*>::iterator i = usedTags.begin(); i != usedTags.end(); i++)
+    if (++m_JournalSize >= BOOKMARKS_JOURNAL_MAX)
+        save();
+}
+
+/**
+ * Apply the edits of a journal file. Adding a bookmark that already exists
+ * and removing one that does not are ignored, so a journal can be replayed
+ * on a file it has already been compacted into.
+ * Every valid line is counted in m_JournalSize, since it stays in the
+ * journal until the next save.
+ * Returns the number of lines applied.
+ */
+int Bookmarks::replayJournal(const QString &filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return 0;
+
+    int applied = 0;
+    while (!file.atEnd())
+    {
+        QString line = QString::fromUtf8(file.readLine().trimmed());
+        if (line.isEmpty() || line.startsWith("#"))
+            continue;
+
+        QStringList strings = line.split(";");
+        QString op = strings.takeFirst().trimmed();
+        BookmarkInfo info;
+        if ((op != "+" && op != "-") || !parseBookmark(strings, info))
         {
-            TagInfo& info = **i;
-            stream << info.name.leftJustified(20) + "; " + info.color.name() << endl;
+            printf("\nBookmarks: Ignoring journal line:\n  %s\n", line.toLatin1().data());
+            continue;
         }
+        m_JournalSize++;
+
+        QList<BookmarkInfo>::iterator it = std::lower_bound(m_BookmarkList.begin(),
+                                                            m_BookmarkList.end(),
+                                                            info);
+        while (it != m_BookmarkList.end() && it->frequency == info.frequency &&
+               it->name != info.name)
+            ++it;
+        bool exists = it != m_BookmarkList.end() && it->frequency == info.frequency;
+
+        if (op == "+" && !exists)
+            m_BookmarkList.insert(std::upper_bound(m_BookmarkList.begin(),
+                                                   m_BookmarkList.end(), info),
+                                  info);
+        else if (op == "-" && exists)
+            m_BookmarkList.erase(it);
+        else
+            continue;
+        applied++;
+    }
+    file.close();
+    invalidateIndex();
 
-        stream << endl;
+    return applied;
+}
 
-        stream << QString("# Frequency").leftJustified(12) + "; " +
-                  QString("Name").leftJustified(25)+ "; " +
-                  QString("Modulation").leftJustified(20) + "; " +
-                  QString("Bandwidth").rightJustified(10) + "; " +
-                  QString("Tags") << endl;
+/**
+ * Write all bookmarks to the CSV file.
+ *
+ * The file is written on a background thread from a snapshot of the
+ * bookmarks. The new file replaces the old one by an atomic rename, after
+ * that the journal with the edits contained in the snapshot is removed.
+ * Errors are reported when the writer has finished; the journal is kept
+ * and compacted by the next save.
+ */
+bool Bookmarks::save()
+{
+    // bookmarks and tags are edited in place before saving
+    invalidateIndex();
 
-        for (int i = 0; i < m_BookmarkList.size(); i++)
+    if (m_Writer->isRunning())
+    {
+        m_SavePending = true;
+        return true;
+    }
+    m_SavePending = false;
+
+    // Edits made from now on go into a new journal. If the previous save
+    // failed its journal is still there, keep both.
+    QString journal = m_bookmarksFile + ".journal";
+    QString oldJournal = journal + ".old";
+    if (QFile::exists(journal))
+    {
+        if (QFile::exists(oldJournal))
         {
-            BookmarkInfo& info = m_BookmarkList[i];
-            QString line = QString::number(info.frequency).rightJustified(12) +
-                    "; " + info.name.leftJustified(25) + "; " +
-                    info.modulation.leftJustified(20)+ "; " +
-                    QString::number(info.bandwidth).rightJustified(10) + "; ";
-            for(int iTag = 0; iTag<info.tags.size(); ++iTag)
+            QFile src(journal), dst(oldJournal);
+            if (src.open(QIODevice::ReadOnly) && dst.open(QIODevice::Append))
             {
-                TagInfo& tag = *info.tags[iTag];
-                if(iTag!=0)
-                {
-                    line.append(",");
-                }
-                line.append(tag.name);
+                dst.write(src.readAll());
+                src.close();
+                src.remove();
             }
+        }
+        else
+        {
+            QFile::rename(journal, oldJournal);
+        }
+    }
+    m_JournalSize = 0;
+
+    m_Writer->m_File = m_bookmarksFile;
+    m_Writer->m_Journal = oldJournal;
+    m_Writer->m_Bookmarks = m_BookmarkList;   // implicitly shared
+    m_Writer->m_TagNames.clear();
+    m_Writer->m_TagColors.clear();
+    for (int i = 0; i < m_TagList.size(); i++)
+    {
+        m_Writer->m_TagNames.insert(&m_TagList.at(i), m_TagList.at(i).name);
+        m_Writer->m_TagColors.insert(&m_TagList.at(i), m_TagList.at(i).color.name());
+    }
+    m_Writer->start(QThread::LowPriority);
+
+    return true;
+}
+
+/**
+ * Finish writing before the application exits.
+ *
+ * Waits for the writer and runs a save that is pending behind it. Edits
+ * that are only in the journal are compacted when the bookmarks are
+ * loaded again.
+ */
+void Bookmarks::flush()
+{
+    m_Writer->wait();
+    if (m_SavePending)
+    {
+        save();
+        m_Writer->wait();
+
+        // finished() is not delivered once the event loop has stopped
+        if (!m_Writer->m_Ok)
+            printf("\nBookmarks: Error writing %s\n", m_bookmarksFile.toLatin1().data());
+    }
+    m_Writer->m_Bookmarks.clear();
+}
 
-            stream << line << endl;
+void Bookmarks::onWriterFinished()
+{
+    if (!m_Writer->m_Ok)
+        printf("\nBookmarks: Error writing %s\n", m_bookmarksFile.toLatin1().data());
+
+    // release the snapshot
+    m_Writer->m_Bookmarks.clear();
+
+    if (m_SavePending)
+        save();
+}
+
+// Runs on its own thread and only reads the snapshot. Tag pointers are used
+// as keys of the tag tables, they are never dereferenced.
+//FIXME: Commas in names
+void BookmarksWriter::run()
+{
+    // QSaveFile writes a temporary file and renames it on commit()
+    QSaveFile file(m_File);
+
+    m_Ok = false;
+    if(!file.open(QFile::WriteOnly | QFile::Truncate | QIODevice::Text))
+        return;
+
+    QTextStream stream(&file);
+
+    stream << QString("# Tag name").leftJustified(20) + "; " +
+              QString(" color") << endl;
+
+    QSet<const TagInfo*> usedTags;
+    for (int iBookmark = 0; iBookmark < m_Bookmarks.size(); iBookmark++)
+    {
+        const BookmarkInfo& info = m_Bookmarks.at(iBookmark);
+        for(int iTag = 0; iTag < info.tags.size(); ++iTag)
+        {
+          usedTags.insert(info.tags[iTag]);
         }
+    }
 
-        file.close();
-        return true;
+    for (QSet<const TagInfo*>::iterator i = usedTags.begin(); i != usedTags.end(); i++)
+    {
+        stream << m_TagNames.value(*i).leftJustified(20) + "; " + m_TagColors.value(*i) << endl;
     }
-    return false;
+
+    stream << endl;
+
+    stream << QString("# Frequency").leftJustified(12) + "; " +
+              QString("Name").leftJustified(25)+ "; " +
+              QString("Modulation").leftJustified(20) + "; " +
+              QString("Bandwidth").rightJustified(10) + "; " +
+              QString("Tags") << endl;
+
+    QStringList tags;
+    for (int i = 0; i < m_Bookmarks.size(); i++)
+    {
+        const BookmarkInfo& info = m_Bookmarks.at(i);
+
+        tags.clear();
+        for(int iTag = 0; iTag<info.tags.size(); ++iTag)
+            tags.append(m_TagNames.value(info.tags[iTag]));
+
+        stream << formatBookmark(info, tags) << endl;
+    }
+
+    stream.flush();
+    if (!file.commit())
+        return;
+
+    QFile::remove(m_Journal);
+    m_Ok = true;
 }
 
 QList<BookmarkInfo> Bookmarks::getBookmarksInRange(qint64 low, qint64 high)
 {
-    BookmarkInfo info;
-    info.frequency=low;
-    QList<BookmarkInfo>::const_iterator lb = qLowerBound(m_BookmarkList, info);
-    info.frequency=high;
-    QList<BookmarkInfo>::const_iterator ub = qUpperBound(m_BookmarkList, info);
+    int first = lowerBound(low);
+    int last = upperBound(high);
 
     QList<BookmarkInfo> found;
 
-    while (lb != ub)
+    for (int i = first; i < last; i++)
+        found.append(m_BookmarkList[i]);
+
+    return found;
+}
+
+/** Index of the first bookmark at or above low. */
+int Bookmarks::lowerBound(qint64 low)
+{
+    updateIndex();
+    return std::lower_bound(m_IdxFreq.begin(), m_IdxFreq.end(), low) - m_IdxFreq.begin();
+}
+
+/** Index of the first bookmark above high. */
+int Bookmarks::upperBound(qint64 high)
+{
+    updateIndex();
+    return std::upper_bound(m_IdxFreq.begin(), m_IdxFreq.end(), high) - m_IdxFreq.begin();
+}
+
+/** Rebuild the frequency index if the bookmarks or tags have changed. */
+void Bookmarks::updateIndex()
+{
+    if (m_IndexValid)
+        return;
+
+    // tags are numbered by their position in the tag list
+    QHash<const TagInfo*, int> numbers;
+    std::vector<char> tag_active(m_TagList.size());
+    int n = m_BookmarkList.size();
+
+    for (int i = 0; i < m_TagList.size(); i++)
+    {
+        numbers.insert(&m_TagList.at(i), i);
+        tag_active[i] = m_TagList.at(i).active;
+    }
+
+    m_IdxFreq.resize(n);
+    m_IdxBandwidth.resize(n);
+    m_MaxBandwidth = 0;
+    m_IdxColor.resize(n);
+    m_IdxActive.resize(n);
+    m_TagBookmarks.clear();
+    for (int i = 0; i < n; i++)
     {
-        const BookmarkInfo& info = *lb;
-        //if(info.IsActive())
+        const BookmarkInfo &info = m_BookmarkList.at(i);
+        char active = 0;
+
+        for (int t = 0; t < info.tags.size(); t++)
         {
-          found.append(info);
+            int num = numbers.value(info.tags[t], -1);
+
+            if (num >= 0)
+            {
+                active = active || tag_active[num];
+                m_TagBookmarks[info.tags[t]].push_back(i);
+            }
         }
-        lb++;
+
+        m_IdxFreq[i] = info.frequency;
+        m_IdxBandwidth[i] = info.bandwidth;
+        m_MaxBandwidth = qMax(m_MaxBandwidth, info.bandwidth);
+        m_IdxColor[i] = info.GetColor().rgba();
+        m_IdxActive[i] = active;
     }
 
-    return found;
+    m_IndexValid = true;
+}
+
+/** Update the color and the state of one bookmark in a valid index. */
+void Bookmarks::updateIndexAt(int i)
+{
+    const BookmarkInfo &info = m_BookmarkList.at(i);
 
+    m_IdxColor[i] = info.GetColor().rgba();
+    m_IdxActive[i] = info.IsActive();
+}
+
+/** Indices of the bookmarks that have a tag, ascending. */
+const std::vector<int>& Bookmarks::bookmarksWithTag(const QString &tagName)
+{
+    static const std::vector<int> none;
+    int idx = getTagIndex(tagName);
+
+    if (idx == -1)
+        return none;
+
+    updateIndex();
+    QHash<const TagInfo*, std::vector<int> >::const_iterator it =
+            m_TagBookmarks.constFind(&m_TagList.at(idx));
+    return it == m_TagBookmarks.constEnd() ? none : it.value();
 }
 
 TagInfo &Bookmarks::findOrAddTag(QString tagName)
@@ -247,6 +712,8 @@ TagInfo &Bookmarks::findOrAddTag(QString tagName)
     TagInfo info;
     info.name=tagName;
     m_TagList.append(info);
+    m_TagIndex.insert(tagName, m_TagList.size() - 1);
+    invalidateIndex();
     emit TagListChanged();
     return m_TagList.last();
 }
@@ -265,23 +732,29 @@ bool Bookmarks::removeTag(QString tagName)
 
     // Delete Tag from all Bookmarks that use it.
     TagInfo* pTagToDelete = &m_TagList[idx];
-    for(int i=0; i<m_BookmarkList.size(); ++i)
+    TagInfo* pUntagged = &findOrAddTag(TagInfo::strUntagged);
+    std::vector<int> changed = bookmarksWithTag(tagName);
+    for(size_t i=0; i<changed.size(); ++i)
     {
-        BookmarkInfo& bmi = m_BookmarkList[i];
+        BookmarkInfo& bmi = m_BookmarkList[changed[i]];
         for(int t=0; t<bmi.tags.size(); ++t)
         {
             TagInfo* pTag = bmi.tags[t];
             if(pTag == pTagToDelete)
             {
                 if(bmi.tags.size()>1) bmi.tags.removeAt(t);
-                else bmi.tags[0] = &findOrAddTag(TagInfo::strUntagged);
+                else bmi.tags[0] = pUntagged;
             }
         }
     }
 
     // Delete Tag.
     m_TagList.removeAt(idx);
+    rebuildTagIndex();
+    invalidateIndex();
 
+    for(size_t i=0; i<changed.size(); ++i)
+        emit BookmarkChanged(changed[i]);
     emit BookmarksChanged();
     emit TagListChanged();
 
@@ -292,22 +765,29 @@ bool Bookmarks::setTagChecked(QString tagName, bool bChecked)
 {
     int idx = getTagIndex(tagName);
     if (idx == -1) return false;
+    if (m_TagList[idx].active == bChecked) return true;
     m_TagList[idx].active = bChecked;
+
+    // only the bookmarks with this tag change
+    const std::vector<int> &changed = bookmarksWithTag(tagName);
+    for (size_t i = 0; i < changed.size(); i++)
+        updateIndexAt(changed[i]);
+
+    emit TagActiveChanged(tagName);
     emit BookmarksChanged();
-    emit TagListChanged();
     return true;
 }
 
 int Bookmarks::getTagIndex(QString tagName)
 {
-    tagName = tagName.trimmed();
-    for (int i = 0; i < m_TagList.size(); i++)
-    {
-        if (m_TagList[i].name == tagName)
-            return i;
-    }
+    return m_TagIndex.value(tagName.trimmed(), -1);
+}
 
-    return -1;
+void Bookmarks::rebuildTagIndex()
+{
+    m_TagIndex.clear();
+    for (int i = 0; i < m_TagList.size(); i++)
+        m_TagIndex.insert(m_TagList[i].name, i);
 }
 
 const QColor BookmarkInfo::GetColor() const
@@ -30,6 +30,11 @@
 #include <QList>
 #include <QStringList>
 #include <QColor>
+#include <QHash>
+#include <QThread>
+#include <vector>
+
+#define BOOKMARKS_JOURNAL_MAX 256   // journal entries before the file is rewritten
 
 struct TagInfo
 {
@@ -94,6 +99,23 @@ struct BookmarkInfo
     bool IsActive() const;
 };
 
+/* Writes a snapshot of the bookmarks to the CSV file, see Bookmarks::save(). */
+class BookmarksWriter : public QThread
+{
+public:
+    BookmarksWriter() : m_Ok(false) {}
+
+    QString     m_File;
+    QString     m_Journal;      // journal compacted into this snapshot
+    QList<BookmarkInfo> m_Bookmarks;
+    QHash<const TagInfo*, QString> m_TagNames;
+    QHash<const TagInfo*, QString> m_TagColors;
+    bool        m_Ok;
+
+protected:
+    void run();
+};
+
 class Bookmarks : public QObject
 {
     Q_OBJECT
@@ -104,13 +126,27 @@ public:
 
     void add(BookmarkInfo& info);
     void remove(int index);
+    void setFrequency(int index, qint64 frequency);
+    void setBookmark(int index, const BookmarkInfo &info);
     bool load();
     bool save();
+    void flush();
     int size() { return m_BookmarkList.size(); }
     BookmarkInfo& getBookmark(int i) { return m_BookmarkList[i]; }
     QList<BookmarkInfo> getBookmarksInRange(qint64 low, qint64 high);
-    //int lowerBound(qint64 low);
-    //int upperBound(qint64 high);
+
+    // Frequency index. The accessors below are valid after updateIndex(),
+    // lowerBound() or upperBound() until the bookmarks change.
+    void updateIndex();
+    int lowerBound(qint64 low);
+    int upperBound(qint64 high);
+    qint64 frequencyAt(int i) const { return m_IdxFreq[i]; }
+    qint64 bandwidthAt(int i) const { return m_IdxBandwidth[i]; }
+    qint64 maxBandwidth() const { return m_MaxBandwidth; }
+    QRgb colorAt(int i) const { return m_IdxColor[i]; }
+    bool isActiveAt(int i) const { return m_IdxActive[i] != 0; }
+    const QString& nameAt(int i) const { return m_BookmarkList.at(i).name; }
+    const std::vector<int>& bookmarksWithTag(const QString &tagName);
 
     QList<TagInfo> getTagList() { return  QList<TagInfo>(m_TagList); }
     TagInfo& findOrAddTag(QString tagName);
@@ -122,13 +158,40 @@ public:
 
 private:
     Bookmarks(); // Singleton Constructor is private.
+    void invalidateIndex() { m_IndexValid = false; }
+    void updateIndexAt(int i);
+    bool parseBookmark(const QStringList &strings, BookmarkInfo &info);
+    void writeJournal(char op, const BookmarkInfo &info);
+    int  replayJournal(const QString &filename);
+    void rebuildTagIndex();
+
     QList<BookmarkInfo> m_BookmarkList;
     QList<TagInfo> m_TagList;
+    QHash<QString, int> m_TagIndex;     // tag name -> index in m_TagList
     QString        m_bookmarksFile;
+    BookmarksWriter *m_Writer;
+    bool           m_SavePending;
+    int            m_JournalSize;
+
+    // Structure of arrays in the order of m_BookmarkList (sorted by frequency)
+    bool                    m_IndexValid;
+    std::vector<qint64>     m_IdxFreq;
+    std::vector<qint64>     m_IdxBandwidth;
+    qint64                  m_MaxBandwidth;
+    std::vector<QRgb>       m_IdxColor;   // color of the first active tag
+    std::vector<char>       m_IdxActive;  // at least one tag is active
+    QHash<const TagInfo*, std::vector<int> > m_TagBookmarks; // bookmarks of each tag, ascending
     static Bookmarks* m_pThis;
 
+private slots:
+    void onWriterFinished();
+
 signals:
     void BookmarksChanged(void);
+    void BookmarkAdded(int index);      // followed by BookmarksChanged()
+    void BookmarkRemoved(int index);    // followed by BookmarksChanged()
+    void BookmarkChanged(int index);    // edited in place, followed by BookmarksChanged()
+    void TagActiveChanged(QString tagName); // followed by BookmarksChanged()
     void TagListChanged(void);
 };
 
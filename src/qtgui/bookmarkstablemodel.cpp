@@ -20,6 +20,7 @@
  * the Free Software Foundation, Inc., 51 Franklin Street,
  * Boston, MA 02110-1301, USA.
  */
+#include <algorithm>
 #include <QFile>
 #include <QStringList>
 #include "bookmarks.h"
@@ -34,7 +35,7 @@ BookmarksTableModel::BookmarksTableModel(QObject *parent) :
 
 int BookmarksTableModel::rowCount ( const QModelIndex & /*parent*/ ) const
 {
-    return m_Bookmarks.size();
+    return m_Rows.size();
 }
 int BookmarksTableModel::columnCount ( const QModelIndex & /*parent*/ ) const
 {
@@ -73,11 +74,14 @@ QVariant BookmarksTableModel::headerData ( int section, Qt::Orientation orientat
 
 QVariant BookmarksTableModel::data ( const QModelIndex & index, int role ) const
 {
-    BookmarkInfo& info = *m_Bookmarks[index.row()];
+    Bookmarks& bookmarks = Bookmarks::Get();
+    int iBookmark = m_Rows[index.row()];
+    BookmarkInfo& info = bookmarks.getBookmark(iBookmark);
 
     if(role==Qt::BackgroundColorRole)
     {
-        QColor bg(info.GetColor());
+        bookmarks.updateIndex();
+        QColor bg(bookmarks.colorAt(iBookmark));
         bg.setAlpha(0x60);
         return bg;
     }
@@ -114,36 +118,33 @@ bool BookmarksTableModel::setData(const QModelIndex &index, const QVariant &valu
 {
     if(role==Qt::EditRole)
     {
-        BookmarkInfo &info = *m_Bookmarks[index.row()];
+        // edit a copy, setBookmark() journals the old and the new bookmark
+        int iBookmark = m_Rows[index.row()];
+        BookmarkInfo info = Bookmarks::Get().getBookmark(iBookmark);
         switch(index.column())
         {
         case COL_FREQUENCY:
             {
-                info.frequency = value.toLongLong();
-                emit dataChanged(index, index);
+                // moves the bookmark, the rows are updated by onBookmarkAdded()
+                Bookmarks::Get().setFrequency(iBookmark, value.toLongLong());
             }
-            break;
+            return true;
         case COL_NAME:
             {
                 info.name = value.toString();
-                emit dataChanged(index, index);
-                return true;
             }
             break;
         case COL_MODULATION:
             {
                 Q_ASSERT(!value.toString().contains(";")); // may not contain a comma because tablemodel is saved as comma-separated file (csv).
-                if(DockRxOpt::IsModulationValid(value.toString()))
-                {
-                    info.modulation = value.toString();
-                    emit dataChanged(index, index);
-                }
+                if(!DockRxOpt::IsModulationValid(value.toString()))
+                    return true;
+                info.modulation = value.toString();
             }
             break;
         case COL_BANDWIDTH:
             {
                 info.bandwidth = value.toInt();
-                emit dataChanged(index, index);
             }
             break;
         case COL_TAGS:
@@ -156,11 +157,13 @@ bool BookmarksTableModel::setData(const QModelIndex &index, const QVariant &valu
                     QString strTag = strList[i].trimmed();
                     info.tags.append( &Bookmarks::Get().findOrAddTag(strTag) );
                 }
-                emit dataChanged(index, index);
-                return true;
             }
             break;
+        default:
+            return true;
         }
+        // the row is updated by onBookmarkChanged()
+        Bookmarks::Get().setBookmark(iBookmark, info);
         return true; // return true means success
     }
     return false;
@@ -185,42 +188,123 @@ Qt::ItemFlags BookmarksTableModel::flags ( const QModelIndex& index ) const
     return flags;
 }
 
+/** Rebuild all rows, e.g. after the bookmarks have been loaded. */
 void BookmarksTableModel::update()
 {
-    int iRow = 0;
-    m_Bookmarks.clear();
-    for(int iBookmark=0; iBookmark<Bookmarks::Get().size(); iBookmark++)
+    Bookmarks& bookmarks = Bookmarks::Get();
+
+    beginResetModel();
+    bookmarks.updateIndex();
+    m_Rows.clear();
+    for(int iBookmark=0; iBookmark<bookmarks.size(); iBookmark++)
     {
-        BookmarkInfo& info = Bookmarks::Get().getBookmark(iBookmark);
+        if(bookmarks.isActiveAt(iBookmark))
+            m_Rows.push_back(iBookmark);
+    }
+    endResetModel();
+}
+
+void BookmarksTableModel::onBookmarkAdded(int index)
+{
+    Bookmarks& bookmarks = Bookmarks::Get();
+    std::vector<int>::iterator it = std::lower_bound(m_Rows.begin(), m_Rows.end(), index);
+    int row = it - m_Rows.begin();
+
+    for (std::vector<int>::iterator i = it; i != m_Rows.end(); ++i)
+        ++*i;
+
+    bookmarks.updateIndex();
+    if (!bookmarks.isActiveAt(index))
+        return;
+
+    beginInsertRows(QModelIndex(), row, row);
+    m_Rows.insert(m_Rows.begin() + row, index);
+    endInsertRows();
+}
+
+void BookmarksTableModel::onBookmarkRemoved(int index)
+{
+    std::vector<int>::iterator it = std::lower_bound(m_Rows.begin(), m_Rows.end(), index);
+    int row = it - m_Rows.begin();
+
+    // the indices must be valid when the views are notified
+    if (it != m_Rows.end() && *it == index)
+    {
+        beginRemoveRows(QModelIndex(), row, row);
+        m_Rows.erase(m_Rows.begin() + row);
+        for (std::vector<int>::iterator i = m_Rows.begin() + row; i != m_Rows.end(); ++i)
+            --*i;
+        endRemoveRows();
+    }
+    else
+    {
+        for (std::vector<int>::iterator i = it; i != m_Rows.end(); ++i)
+            --*i;
+    }
+}
+
+/** A bookmark has been edited, its tags may no longer be active. */
+void BookmarksTableModel::onBookmarkChanged(int index)
+{
+    refilter(index);
+}
+
+/** Show or hide the bookmarks of a tag that has been checked or unchecked. */
+void BookmarksTableModel::onTagActiveChanged(const QString &tagName)
+{
+    const std::vector<int> &changed = Bookmarks::Get().bookmarksWithTag(tagName);
+
+    for (size_t i = 0; i < changed.size(); i++)
+        refilter(changed[i]);
+}
+
+/** Insert, remove or update the row of a bookmark after its state changed. */
+void BookmarksTableModel::refilter(int index)
+{
+    Bookmarks& bookmarks = Bookmarks::Get();
+    std::vector<int>::iterator it = std::lower_bound(m_Rows.begin(), m_Rows.end(), index);
+    int row = it - m_Rows.begin();
+    bool shown = it != m_Rows.end() && *it == index;
 
-        bool bActive = false;
-        for(int iTag=0; iTag<info.tags.size(); ++iTag)
+    bookmarks.updateIndex();
+    if (bookmarks.isActiveAt(index))
+    {
+        if (shown)
         {
-            TagInfo& tag = *info.tags[iTag];
-            if(tag.active)
-            {
-                bActive = true;
-                break;
-            }
+            // the color may have changed
+            emit dataChanged(this->index(row, 0), this->index(row, columnCount() - 1));
         }
-        if(bActive)
+        else
         {
-            m_mapRowToBookmarksIndex[iRow]=iBookmark;
-            m_Bookmarks.append(&info);
-            ++iRow;
+            beginInsertRows(QModelIndex(), row, row);
+            m_Rows.insert(it, index);
+            endInsertRows();
         }
     }
-
-    emit layoutChanged();
+    else if (shown)
+    {
+        beginRemoveRows(QModelIndex(), row, row);
+        m_Rows.erase(it);
+        endRemoveRows();
+    }
 }
 
 BookmarkInfo *BookmarksTableModel::getBookmarkAtRow(int row)
 {
-    return m_Bookmarks[row];
+    return &Bookmarks::Get().getBookmark(m_Rows[row]);
 }
 
 int BookmarksTableModel::GetBookmarksIndexForRow(int iRow)
 {
-  return m_mapRowToBookmarksIndex[iRow];
+  return m_Rows[iRow];
 }
 
+/** Row showing a bookmark, -1 if it is filtered out. */
+int BookmarksTableModel::getRowForBookmarksIndex(int index) const
+{
+    std::vector<int>::const_iterator it = std::lower_bound(m_Rows.begin(), m_Rows.end(), index);
+
+    if (it == m_Rows.end() || *it != index)
+        return -1;
+    return it - m_Rows.begin();
+}
@@ -25,6 +25,7 @@
 
 #include <QAbstractTableModel>
 #include <QList>
+#include <vector>
 
 #include "bookmarks.h"
 
@@ -54,14 +55,22 @@ public:
 
     BookmarkInfo* getBookmarkAtRow(int row);
     int GetBookmarksIndexForRow(int iRow);
+    int getRowForBookmarksIndex(int index) const;
 
 private:
-    QList<BookmarkInfo*> m_Bookmarks;
-    QMap<int,int> m_mapRowToBookmarksIndex;
+    // Bookmarks index of each row, ascending. The rows are a view on the
+    // bookmarks with an active tag; cell data is only created on request.
+    std::vector<int> m_Rows;
+
+    void refilter(int index);
 
 signals:
 public slots:
     void update();
+    void onBookmarkAdded(int index);
+    void onBookmarkRemoved(int index);
+    void onBookmarkChanged(int index);
+    void onTagActiveChanged(const QString &tagName);
 
 };
 
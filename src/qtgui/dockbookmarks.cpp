@@ -69,6 +69,12 @@ DockBookmarks::DockBookmarks(QWidget *parent) :
         actionAddBookmark = new QAction("Add Bookmark", this);
         contextmenu->addAction(actionAddBookmark);
     }
+    // MenuItem Add detected signals
+    {
+        actionAddDetected = new QAction("Add Detected Signals", this);
+        actionAddDetected->setEnabled(false);
+        contextmenu->addAction(actionAddDetected);
+    }
     ui->tableViewFrequencyList->setContextMenuPolicy(Qt::CustomContextMenu);
     connect(ui->tableViewFrequencyList, SIGNAL(customContextMenuRequested(const QPoint&)),
         this, SLOT(ShowContextMenu(const QPoint&)));
@@ -87,12 +93,16 @@ DockBookmarks::DockBookmarks(QWidget *parent) :
             this, SLOT(activated(const QModelIndex &)));
     connect(ui->tableViewFrequencyList, SIGNAL(doubleClicked(const QModelIndex &)),
             this, SLOT(doubleClicked(const QModelIndex &)));
-    connect(bookmarksTableModel, SIGNAL(dataChanged(const QModelIndex &, const QModelIndex &)),
-            this, SLOT(onDataChanged(const QModelIndex &, const QModelIndex &)));
     connect(&Bookmarks::Get(), SIGNAL(TagListChanged()),
             ui->tableWidgetTagList, SLOT(updateTags()));
-    connect(&Bookmarks::Get(), SIGNAL(BookmarksChanged()),
-            bookmarksTableModel, SLOT(update()));
+    connect(&Bookmarks::Get(), SIGNAL(TagActiveChanged(QString)),
+            bookmarksTableModel, SLOT(onTagActiveChanged(QString)));
+    connect(&Bookmarks::Get(), SIGNAL(BookmarkAdded(int)),
+            bookmarksTableModel, SLOT(onBookmarkAdded(int)));
+    connect(&Bookmarks::Get(), SIGNAL(BookmarkRemoved(int)),
+            bookmarksTableModel, SLOT(onBookmarkRemoved(int)));
+    connect(&Bookmarks::Get(), SIGNAL(BookmarkChanged(int)),
+            bookmarksTableModel, SLOT(onBookmarkChanged(int)));
 }
 
 DockBookmarks::~DockBookmarks()
@@ -110,11 +120,18 @@ void DockBookmarks::activated(const QModelIndex & index)
 void DockBookmarks::setNewFrequency(qint64 rx_freq)
 {
     ui->tableViewFrequencyList->clearSelection();
-    const int iRowCount = bookmarksTableModel->rowCount();
-    for (int row = 0; row < iRowCount; ++row)
+
+    // only bookmarks within the largest bandwidth can match
+    Bookmarks& bookmarks = Bookmarks::Get();
+    bookmarks.updateIndex();
+    qint64 reach = bookmarks.maxBandwidth() / 2 + 1;
+    const int first = bookmarks.lowerBound(rx_freq - reach);
+    const int last = bookmarks.upperBound(rx_freq + reach);
+    for (int i = first; i < last; ++i)
     {
-        BookmarkInfo& info = *(bookmarksTableModel->getBookmarkAtRow(row));
-        if (std::abs(rx_freq - info.frequency) <= ((info.bandwidth / 2 ) + 1))
+        int row = bookmarksTableModel->getRowForBookmarksIndex(i);
+        if (row >= 0 &&
+            std::abs(rx_freq - bookmarks.frequencyAt(i)) <= ((bookmarks.bandwidthAt(i) / 2 ) + 1))
         {
             ui->tableViewFrequencyList->selectRow(row);
             ui->tableViewFrequencyList->scrollTo(ui->tableViewFrequencyList->currentIndex(), QAbstractItemView::EnsureVisible );
@@ -136,13 +153,6 @@ void DockBookmarks::updateBookmarks()
     bookmarksTableModel->update();
 }
 
-//Data has been edited
-void DockBookmarks::onDataChanged(const QModelIndex&, const QModelIndex &)
-{
-    updateTags();
-    Bookmarks::Get().save();
-}
-
 void DockBookmarks::on_tableWidgetTagList_itemChanged(QTableWidgetItem *item)
 {
     // we only want to react on changed by the user, not changes by the program itself.
@@ -182,7 +192,6 @@ bool DockBookmarks::DeleteSelectedBookmark()
     {
         int iIndex = bookmarksTableModel->GetBookmarksIndexForRow(selected.first().row());
         Bookmarks::Get().remove(iIndex);
-        bookmarksTableModel->update();
     }
     return true;
 }
@@ -236,7 +245,7 @@ void DockBookmarks::changeBookmarkTags(int row, int /*column*/)
     QString tags; // list of tags separated by comma
 
     int iIdx = bookmarksTableModel->GetBookmarksIndexForRow(row);
-    BookmarkInfo& bmi = Bookmarks::Get().getBookmark(iIdx);
+    BookmarkInfo bmi = Bookmarks::Get().getBookmark(iIdx);
 
     // Create and show the Dialog for a new Bookmark.
     // Write the result into variabe 'tags'.
@@ -275,7 +284,7 @@ void DockBookmarks::changeBookmarkTags(int row, int /*column*/)
             {
                 bmi.tags.append(&Bookmarks::Get().findOrAddTag(listTags[i]));
             }
-            Bookmarks::Get().save();
+            Bookmarks::Get().setBookmark(iIdx, bmi);
         }
     }
 }
@@ -61,6 +61,7 @@ public:
     // ui->tableWidgetTagList
     BookmarksTableModel *bookmarksTableModel;
     QAction* actionAddBookmark;
+    QAction* actionAddDetected;  // enabled while the signal tracker has signals
 
     void updateTags();
     void updateBookmarks();
@@ -74,7 +75,6 @@ public slots:
 
 private slots:
     void activated(const QModelIndex & index );
-    void onDataChanged (const QModelIndex & topLeft, const QModelIndex & bottomRight);
     //void on_addButton_clicked();
     //void on_delButton_clicked();
     void on_tableWidgetTagList_itemChanged(QTableWidgetItem* item);
@@ -35,6 +35,11 @@
 #define DEFAULT_WATERFALL_SPAN  0       // Auto
 #define DEFAULT_FFT_SPLIT       35
 #define DEFAULT_FFT_AVG         75
+#define DEFAULT_WELCH_SEG       0       // Off
+#define DEFAULT_WELCH_OVR       2       // 50%
+#define DEFAULT_FFT_THREADS     0       // 1 thread
+#define DEFAULT_FFT_MT_SIZE     1       // 256k
+#define DEFAULT_WF_HISTORY      1       // 64 MB
 #define DEFAULT_COLORMAP        "gqrx"
 
 DockFft::DockFft(QWidget *parent) :
@@ -52,6 +57,7 @@ DockFft::DockFft(QWidget *parent) :
     ui->resetButton->setAttribute(Qt::WA_LayoutUsesWidgetRect);
     ui->centerButton->setAttribute(Qt::WA_LayoutUsesWidgetRect);
     ui->demodButton->setAttribute(Qt::WA_LayoutUsesWidgetRect);
+    ui->zoomFftButton->setAttribute(Qt::WA_LayoutUsesWidgetRect);
 #endif
 #endif
 
@@ -63,6 +69,7 @@ DockFft::DockFft(QWidget *parent) :
     ui->resetButton->setMinimumSize(48, 24);
     ui->centerButton->setMinimumSize(48, 24);
     ui->demodButton->setMinimumSize(48, 24);
+    ui->zoomFftButton->setMinimumSize(48, 24);
     ui->fillButton->setMinimumSize(48, 24);
     ui->colorPicker->setMinimumSize(48, 24);
 #endif
@@ -227,6 +234,36 @@ void DockFft::saveSettings(QSettings *settings)
     else
         settings->remove("averaging");
 
+    intval = ui->welchSegComboBox->currentIndex();
+    if (intval != DEFAULT_WELCH_SEG)
+        settings->setValue("welch_segments", intval);
+    else
+        settings->remove("welch_segments");
+
+    intval = ui->welchOvrComboBox->currentIndex();
+    if (intval != DEFAULT_WELCH_OVR)
+        settings->setValue("welch_overlap", intval);
+    else
+        settings->remove("welch_overlap");
+
+    intval = ui->threadsComboBox->currentIndex();
+    if (intval != DEFAULT_FFT_THREADS)
+        settings->setValue("threads", intval);
+    else
+        settings->remove("threads");
+
+    intval = ui->threadsSizeComboBox->currentIndex();
+    if (intval != DEFAULT_FFT_MT_SIZE)
+        settings->setValue("threads_min_size", intval);
+    else
+        settings->remove("threads_min_size");
+
+    intval = ui->wfHistoryComboBox->currentIndex();
+    if (intval != DEFAULT_WF_HISTORY)
+        settings->setValue("waterfall_history", intval);
+    else
+        settings->remove("waterfall_history");
+
     if (ui->fftSplitSlider->value() != DEFAULT_FFT_SPLIT)
         settings->setValue("split", ui->fftSplitSlider->value());
     else
@@ -238,6 +275,11 @@ void DockFft::saveSettings(QSettings *settings)
     else
         settings->remove("pandapter_color");
 
+    if (ui->zoomFftButton->isChecked())
+        settings->setValue("zoom_fft", true);
+    else
+        settings->remove("zoom_fft");
+
     if (ui->fillButton->isChecked())
         settings->remove("pandapter_fill");
     else
@@ -316,6 +358,26 @@ void DockFft::readSettings(QSettings *settings)
     if (conv_ok)
         ui->fftAvgSlider->setValue(intval);
 
+    intval = settings->value("welch_segments", DEFAULT_WELCH_SEG).toInt(&conv_ok);
+    if (conv_ok)
+        ui->welchSegComboBox->setCurrentIndex(intval);
+
+    intval = settings->value("welch_overlap", DEFAULT_WELCH_OVR).toInt(&conv_ok);
+    if (conv_ok)
+        ui->welchOvrComboBox->setCurrentIndex(intval);
+
+    intval = settings->value("threads", DEFAULT_FFT_THREADS).toInt(&conv_ok);
+    if (conv_ok)
+        ui->threadsComboBox->setCurrentIndex(intval);
+
+    intval = settings->value("threads_min_size", DEFAULT_FFT_MT_SIZE).toInt(&conv_ok);
+    if (conv_ok)
+        ui->threadsSizeComboBox->setCurrentIndex(intval);
+
+    intval = settings->value("waterfall_history", DEFAULT_WF_HISTORY).toInt(&conv_ok);
+    if (conv_ok)
+        ui->wfHistoryComboBox->setCurrentIndex(intval);
+
     intval = settings->value("split", DEFAULT_FFT_SPLIT).toInt(&conv_ok);
     if (conv_ok)
         ui->fftSplitSlider->setValue(intval);
@@ -326,6 +388,9 @@ void DockFft::readSettings(QSettings *settings)
     bool_val = settings->value("pandapter_fill", true).toBool();
     ui->fillButton->setChecked(bool_val);
 
+    bool_val = settings->value("zoom_fft", false).toBool();
+    ui->zoomFftButton->setChecked(bool_val);
+
     // delete old dB settings from config
     if (settings->contains("reference_level"))
         settings->remove("reference_level");
@@ -432,11 +497,24 @@ void DockFft::on_wfSpanComboBox_currentIndexChanged(int index)
 }
 
 /** Set waterfall time resolution. */
-void DockFft::setWfResolution(quint64 msec_per_line)
+void DockFft::setWfResolution(quint64 msec_per_line, int history_lines)
 {
     float res = 1.0e-3 * (float)msec_per_line;
 
     ui->wfResLabel->setText(QString("Res: %1 s").arg(res, 0, 'f', 2));
+
+    if (history_lines > 0)
+    {
+        quint64 span_min = msec_per_line * history_lines / 60000;
+
+        ui->wfResLabel->setToolTip(tr("Waterfall history: %1 h %2 min")
+                                   .arg(span_min / 60)
+                                   .arg(span_min % 60, 2, 10, QChar('0')));
+    }
+    else
+    {
+        ui->wfResLabel->setToolTip(tr("Waterfall history disabled"));
+    }
 }
 
 /**
@@ -456,6 +534,50 @@ void DockFft::on_fftAvgSlider_valueChanged(int value)
     emit fftAvgChanged(avg);
 }
 
+/** Number of Welch segments changed. */
+void DockFft::on_welchSegComboBox_currentIndexChanged(int index)
+{
+    ui->welchOvrComboBox->setEnabled(index > 0);
+    emitWelchChanged();
+}
+
+/** Overlap between Welch segments changed. */
+void DockFft::on_welchOvrComboBox_currentIndexChanged(int index)
+{
+    Q_UNUSED(index);
+    emitWelchChanged();
+}
+
+/** Number of FFT threads changed. */
+void DockFft::on_threadsComboBox_currentIndexChanged(int index)
+{
+    ui->threadsSizeComboBox->setEnabled(index > 0);
+    emitThreadsChanged();
+}
+
+/** Minimum size of multi-threaded FFTs changed. */
+void DockFft::on_threadsSizeComboBox_currentIndexChanged(int index)
+{
+    Q_UNUSED(index);
+    emitThreadsChanged();
+}
+
+/** Size of the waterfall history in MB, 0 if it is disabled. */
+int DockFft::wfHistorySize()
+{
+    int index = ui->wfHistoryComboBox->currentIndex();
+
+    // items are off and powers of four starting at 64 MB
+    return index > 0 ? 64 << (2 * (index - 1)) : 0;
+}
+
+/** Waterfall history size changed. */
+void DockFft::on_wfHistoryComboBox_currentIndexChanged(int index)
+{
+    Q_UNUSED(index);
+    emit wfHistoryChanged(wfHistorySize());
+}
+
 /** FFT zoom level changed */
 void DockFft::on_fftZoomSlider_valueChanged(int level)
 {
@@ -498,6 +620,12 @@ void DockFft::on_demodButton_clicked(void)
     emit gotoDemodFreq();
 }
 
+/** Zoom FFT button toggled. */
+void DockFft::on_zoomFftButton_toggled(bool checked)
+{
+    emit fftZoomModeToggled(checked);
+}
+
 /** FFT color has changed. */
 void DockFft::on_colorPicker_colorChanged(const QColor &color)
 {
@@ -548,6 +676,31 @@ void DockFft::on_cmapComboBox_currentIndexChanged(int index)
     emit wfColormapChanged(ui->cmapComboBox->currentData().toString());
 }
 
+/** Read Welch settings from the combo boxes and emit fftWelchChanged(). */
+void DockFft::emitWelchChanged(void)
+{
+    int     segments = 0;
+    float   overlap;
+
+    // item 0 is "Off", the others are powers of two starting at 2
+    if (ui->welchSegComboBox->currentIndex() > 0)
+        segments = 1 << ui->welchSegComboBox->currentIndex();
+
+    overlap = 0.25f * (float)ui->welchOvrComboBox->currentIndex();
+
+    emit fftWelchChanged(segments, overlap);
+}
+
+/** Read thread settings from the combo boxes and emit fftThreadsChanged(). */
+void DockFft::emitThreadsChanged(void)
+{
+    // items are powers of two starting at 1 thread and 128k points
+    int threads = 1 << ui->threadsComboBox->currentIndex();
+    int min_size = 131072 << ui->threadsSizeComboBox->currentIndex();
+
+    emit fftThreadsChanged(threads, min_size);
+}
+
 /** Update RBW and FFT overlab labels */
 void DockFft::updateInfoLabels(void)
 {
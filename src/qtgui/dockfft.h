@@ -47,6 +47,8 @@ public:
 
     void setSampleRate(float sample_rate);
 
+    int wfHistorySize();
+
     void saveSettings(QSettings *settings);
     void readSettings(QSettings *settings);
 
@@ -55,9 +57,13 @@ signals:
     void fftRateChanged(int fps);                  /*! FFT rate changed. */
     void fftWindowChanged(int window);             /*! FFT window type changed */
     void wfSpanChanged(quint64 span_ms);           /*! Waterfall span changed. */
+    void wfHistoryChanged(int size_mb);            /*! Waterfall history size changed, 0 is off. */
     void fftSplitChanged(int pct);                 /*! Split between pandapter and waterfall changed. */
     void fftZoomChanged(float level);              /*! Zoom level slider changed. */
     void fftAvgChanged(float gain);                /*! FFT video filter gain has changed. */
+    void fftWelchChanged(int segments, float overlap); /*! Welch averaging changed. */
+    void fftThreadsChanged(int threads, int min_size); /*! Number of FFT threads changed. */
+    void fftZoomModeToggled(bool enabled);         /*! Toggle FFT of the zoomed span. */
     void pandapterRangeChanged(float min, float max);
     void waterfallRangeChanged(float min, float max);
     void resetFftZoom(void);                       /*! FFT zoom reset. */
@@ -72,7 +78,7 @@ signals:
 public slots:
     void setPandapterRange(float min, float max);
     void setWaterfallRange(float min, float max);
-    void setWfResolution(quint64 msec_per_line);
+    void setWfResolution(quint64 msec_per_line, int history_lines = 0);
     void setZoomLevel(float level);
 
 private slots:
@@ -82,12 +88,18 @@ private slots:
     void on_wfSpanComboBox_currentIndexChanged(int index);
     void on_fftSplitSlider_valueChanged(int value);
     void on_fftAvgSlider_valueChanged(int value);
+    void on_welchSegComboBox_currentIndexChanged(int index);
+    void on_welchOvrComboBox_currentIndexChanged(int index);
+    void on_threadsComboBox_currentIndexChanged(int index);
+    void on_threadsSizeComboBox_currentIndexChanged(int index);
+    void on_wfHistoryComboBox_currentIndexChanged(int index);
     void on_fftZoomSlider_valueChanged(int level);
     void on_pandRangeSlider_valuesChanged(int min, int max);
     void on_wfRangeSlider_valuesChanged(int min, int max);
     void on_resetButton_clicked(void);
     void on_centerButton_clicked(void);
     void on_demodButton_clicked(void);
+    void on_zoomFftButton_toggled(bool checked);
     void on_colorPicker_colorChanged(const QColor &);
     void on_fillButton_toggled(bool checked);
     void on_peakHoldButton_toggled(bool checked);
@@ -97,6 +109,8 @@ private slots:
 
 private:
     void updateInfoLabels(void);
+    void emitWelchChanged(void);
+    void emitThreadsChanged(void);
 
 private:
     Ui::DockFft   * ui;
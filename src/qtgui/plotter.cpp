@@ -27,6 +27,7 @@
  * authors and should not be interpreted as representing official policies, either expressed
  * or implied, of Moe Wheatley.
  */
+#include <algorithm>
 #include <cmath>
 
 #ifndef _MSC_VER
@@ -62,10 +63,25 @@ int gettimeofday(struct timeval * tp, struct timezone * tzp)
 #include <QFont>
 #include <QPainter>
 #include <QtGlobal>
+#include <QThread>
 #include <QToolTip>
+#include <volk/volk.h>
 #include "plotter.h"
 #include "bookmarks.h"
 
+/* Thread drawing the frames handed over by CPlotter::draw() */
+class CPlotterRenderThread : public QThread
+{
+public:
+    explicit CPlotterRenderThread(CPlotter *plotter) : m_plotter(plotter) {}
+
+protected:
+    void run() { m_plotter->renderLoop(); }
+
+private:
+    CPlotter   *m_plotter;
+};
+
 // Comment out to enable plotter debug messages
 //#define PLOTTER_DEBUG
 
@@ -150,6 +166,12 @@ CPlotter::CPlotter(QWidget *parent) : QFrame(parent)
 
     m_Span = 96000;
     m_SampleFreq = 96000;
+    m_fftDataCenter = 0;
+    m_fftDataBw = 0.f;
+    m_BinMapFftSize = 0;
+    m_BinMapWidth = 0;
+    m_BinMapMin = 0;
+    m_BinMapMax = 0;
 
     m_HorDivs = 12;
     m_VerDivs = 6;
@@ -160,9 +182,15 @@ CPlotter::CPlotter(QWidget *parent) : QFrame(parent)
     m_CursorCaptured = NOCAP;
     m_Running = false;
     m_DrawOverlay = true;
-    m_2DPixmap = QPixmap(0,0);
-    m_OverlayPixmap = QPixmap(0,0);
-    m_WaterfallPixmap = QPixmap(0,0);
+    m_BookmarksDirty = true;
+    m_2DImage = QImage();
+    m_OverlayImage = QImage();
+    m_WaterfallImage = QImage();
+    m_WfScroll = 0;
+    m_WfHistAccCenter = 0;
+    m_WfHistAccBw = 0.f;
+    m_WfHistAccValid = false;
+    m_WfLine = 0;
     m_Size = QSize(0,0);
     m_GrabPosition = 0;
     m_Percent2DScreen = 35;	//percent of screen used for 2D display
@@ -171,8 +199,7 @@ CPlotter::CPlotter(QWidget *parent) : QFrame(parent)
 
     m_FreqDigits = 3;
 
-    m_Peaks = QMap<int,int>();
-    setPeakDetection(false, 2);
+    setPeakDetection(false);
     m_PeakHoldValid = false;
 
     setFftPlotColor(QColor(0xFF,0xFF,0xFF,0xFF));
@@ -184,10 +211,25 @@ CPlotter::CPlotter(QWidget *parent) : QFrame(parent)
     wf_span = 0;
     fft_rate = 15;
     memset(m_wfbuf, 255, MAX_SCREENSIZE);
+
+    m_fftData = 0;
+    m_wfData = 0;
+    m_fftDataSize = 0;
+    m_JobPending = false;
+    m_RenderQuit = false;
+    m_RenderThread = new CPlotterRenderThread(this);
+    m_RenderThread->start();
 }
 
 CPlotter::~CPlotter()
 {
+    m_RenderMutex.lock();
+    m_RenderQuit = true;
+    m_RenderCond.wakeOne();
+    m_RenderMutex.unlock();
+
+    m_RenderThread->wait();
+    delete m_RenderThread;
 }
 
 QSize CPlotter::minimumSizeHint() const
@@ -206,7 +248,7 @@ void CPlotter::mouseMoveEvent(QMouseEvent* event)
     QPoint pt = event->pos();
 
     /* mouse ent er / mouse leave events */
-    if (m_OverlayPixmap.rect().contains(pt))
+    if (m_OverlayImage.rect().contains(pt))
     {
         //is in Overlay bitmap region
         if (event->buttons() == Qt::NoButton)
@@ -326,7 +368,7 @@ void CPlotter::mouseMoveEvent(QMouseEvent* event)
             // move Y scale up/down
             float delta_px = m_Yzero - pt.y();
             float delta_db = delta_px * fabs(m_PandMindB - m_PandMaxdB) /
-                    (float)m_OverlayPixmap.height();
+                    (float)m_OverlayImage.height();
             m_PandMindB -= delta_db;
             m_PandMaxdB -= delta_db;
             if (out_of_range(m_PandMindB, m_PandMaxdB))
@@ -356,7 +398,7 @@ void CPlotter::mouseMoveEvent(QMouseEvent* event)
             setCursor(QCursor(Qt::ClosedHandCursor));
             // pan viewable range or move center frequency
             int delta_px = m_Xzero - pt.x();
-            qint64 delta_hz = delta_px * m_Span / m_OverlayPixmap.width();
+            qint64 delta_hz = delta_px * m_Span / m_OverlayImage.width();
             if (event->buttons() & Qt::MidButton)
             {
                 m_CenterFreq += delta_hz;
@@ -481,48 +523,170 @@ void CPlotter::mouseMoveEvent(QMouseEvent* event)
 }
 
 
-int CPlotter::getNearestPeak(QPoint pt)
+/**
+ * @brief Find the tracked signal closest to a point on the pandapter.
+ * @param pt The point.
+ * @param freq The frequency of the signal found.
+ * @return TRUE if a signal is close enough to the point.
+ */
+bool CPlotter::getNearestPeak(QPoint pt, qint64 &freq)
 {
-    QMap<int, int>::const_iterator i = m_Peaks.lowerBound(pt.x() - PEAK_CLICK_MAX_H_DISTANCE);
-    QMap<int, int>::const_iterator upperBound = m_Peaks.upperBound(pt.x() + PEAK_CLICK_MAX_H_DISTANCE);
+    float   db_range = m_PandMaxdB - m_PandMindB;
+    float   h = m_OverlayImage.height();
     float   dist = 1.0e10;
-    int     best = -1;
+    bool    found = false;
 
-    for ( ; i != upperBound; i++)
+    for (size_t i = 0; i < m_Signals.size(); i++)
     {
-        int x = i.key();
-        int y = i.value();
+        int x = xFromFreq((qint64)m_Signals[i].frequency);
+        int y = (int)(h * (m_PandMaxdB - m_Signals[i].level) / db_range);
 
-        if (abs(y - pt.y()) > PEAK_CLICK_MAX_V_DISTANCE)
+        if (abs(x - pt.x()) > PEAK_CLICK_MAX_H_DISTANCE ||
+            abs(y - pt.y()) > PEAK_CLICK_MAX_V_DISTANCE)
             continue;
 
         float d = powf(y - pt.y(), 2) + powf(x - pt.x(), 2);
         if (d < dist)
         {
             dist = d;
-            best = x;
+            freq = llround(m_Signals[i].frequency);
+            found = true;
         }
     }
 
-    return best;
+    return found;
+}
+
+/**
+ * @brief Set the signals found by the signal tracker.
+ *
+ * The signals are marked on the pandapter and used for click-to-tune
+ * while peak detection is enabled.
+ */
+void CPlotter::setSignals(const std::vector<tracked_signal> &sigs)
+{
+    if (m_PeakDetection)
+        m_Signals = sigs;
 }
 
 /** Set waterfall span in milliseconds */
 void CPlotter::setWaterfallSpan(quint64 span_ms)
 {
+    QMutexLocker locker(&m_WfMutex);
+
     wf_span = span_ms;
-    if (m_WaterfallPixmap.height() > 0) {
-        msec_per_wfline = wf_span / m_WaterfallPixmap.height();
+    if (m_WaterfallImage.height() > 0) {
+        msec_per_wfline = wf_span / m_WaterfallImage.height();
     }
-    clearWaterfall();
+    m_WaterfallImage.fill(Qt::black);
+    m_WfLine = 0;
+    memset(m_wfbuf, 255, MAX_SCREENSIZE);
+    redrawWaterfall();
 }
 
+/** Clear the waterfall display. The history, if any, is kept. */
 void CPlotter::clearWaterfall()
 {
-    m_WaterfallPixmap.fill(Qt::black);
+    QMutexLocker locker(&m_WfMutex);
+
+    m_WaterfallImage.fill(Qt::black);
+    m_WfLine = 0;
+    m_WfScroll = 0;
     memset(m_wfbuf, 255, MAX_SCREENSIZE);
 }
 
+/**
+ * @brief Keep the raw waterfall data in a memory mapped ring file.
+ * @param filename The history file. Any existing file is overwritten.
+ * @param size Size of the history file in bytes, 0 disables the history.
+ * @return TRUE if the history is enabled.
+ *
+ * With the history enabled the waterfall can be scrolled back, colormap
+ * and range changes are applied to the visible lines and saveWaterfall()
+ * exports at FFT resolution.
+ */
+bool CPlotter::setWaterfallHistory(const QString &filename, qint64 size)
+{
+    QMutexLocker hist_locker(&m_WfHistMutex);
+    QMutexLocker locker(&m_WfMutex);
+
+    m_WfScroll = 0;
+    m_WfHistAccValid = false;
+    if (size <= 0)
+    {
+        m_WfHistory.close();
+        return false;
+    }
+
+    return m_WfHistory.open(filename, size);
+}
+
+/**
+ * @brief Start writing the waterfall to PNG strips.
+ * @param dir The directory for the strips and their index.
+ * @return TRUE if logging has been started.
+ *
+ * The strips are encoded in the background, see CWaterfallLogger.
+ */
+bool CPlotter::startWaterfallLog(const QString &dir)
+{
+    return m_WfLogger.startLog(dir);
+}
+
+/**
+ * @brief Stop writing the waterfall to PNG strips.
+ * @return The number of lines that have been dropped because the encoder
+ *         could not keep up.
+ */
+quint64 CPlotter::stopWaterfallLog()
+{
+    m_WfLogger.stopLog();
+    return m_WfLogger.droppedRows();
+}
+
+/**
+ * Draw the visible part of the waterfall from the history using the
+ * current frequency span, range and colormap (m_WfMutex held).
+ */
+void CPlotter::redrawWaterfall()
+{
+    int     w = m_WaterfallImage.width();
+    int     h = m_WaterfallImage.height();
+    int     y;
+
+    if (!m_WfHistory.isOpen() || w == 0 || h == 0)
+        return;
+
+    qint64  start = m_CenterFreq + m_FftCenter - m_Span / 2;
+    qint64  stop = start + m_Span;
+
+    m_WfLine = 0;
+    for (y = 0; y < h; y++)
+    {
+        QRgb *line = (QRgb *)m_WaterfallImage.scanLine(y);
+
+        if (!m_WfHistory.renderRow(m_WfScroll + y, line, w, start, stop,
+                                   m_WfMindB, m_WfMaxdB, m_ColorTbl))
+            memset(line, 0, w * sizeof(QRgb));
+    }
+}
+
+/** Copy of the waterfall with the newest line on top (m_WfMutex held). */
+QImage CPlotter::waterfallImage() const
+{
+    QImage      image(m_WaterfallImage.size(), QImage::Format_RGB32);
+    int         w = m_WaterfallImage.width();
+    int         h = m_WaterfallImage.height();
+    int         y;
+
+    for (y = 0; y < h; y++)
+        memcpy(image.scanLine(y),
+               m_WaterfallImage.constScanLine((y + m_WfLine) % h),
+               w * sizeof(QRgb));
+
+    return image;
+}
+
 /**
  * @brief Save waterfall to a graphics file
  * @param filename
@@ -533,19 +697,56 @@ void CPlotter::clearWaterfall()
 bool CPlotter::saveWaterfall(const QString & filename) const
 {
     QBrush          axis_brush(QColor(0x00, 0x00, 0x00, 0x70), Qt::SolidPattern);
-    QPixmap         pixmap(m_WaterfallPixmap);
-    QPainter        painter(&pixmap);
+    QImage          image;
+    std::vector<quint64>    line_ms;    // time stamp of each line
+    int             bins;
+    float           bw;
+    int             y;
+
+    // the render thread keeps drawing while we annotate our copy
+    m_WfMutex.lock();
+    line_ms.resize(m_WaterfallImage.height());
+    if (m_WfHistory.isOpen() &&
+        m_WfHistory.rowInfo(m_WfScroll, 0, 0, &bw, &bins))
+    {
+        // export the history at FFT resolution
+        qint64  start = m_CenterFreq + m_FftCenter - m_Span / 2;
+        int     width = qBound(m_WaterfallImage.width(),
+                               (int)(bins * m_Span / bw),
+                               WF_HISTORY_MAX_BINS);
+
+        image = QImage(width, m_WaterfallImage.height(), QImage::Format_RGB32);
+        for (y = 0; y < image.height(); y++)
+        {
+            QRgb *line = (QRgb *)image.scanLine(y);
+
+            if (!m_WfHistory.renderRow(m_WfScroll + y, line, width,
+                                       start, start + m_Span,
+                                       m_WfMindB, m_WfMaxdB, m_ColorTbl))
+                memset(line, 0, width * sizeof(QRgb));
+            line_ms[y] = lineTime(y);
+        }
+    }
+    else
+    {
+        image = waterfallImage();
+        for (y = 0; y < image.height(); y++)
+            line_ms[y] = lineTime(y);
+    }
+    m_WfMutex.unlock();
+
+    QPainter        painter(&image);
     QRect           rect;
     QDateTime       tt;
     QFont           font("sans-serif");
     QFontMetrics    font_metrics(font);
     float           pixperdiv;
-    int             x, y, w, h;
+    int             x, w, h;
     int             hxa, wya = 85;
     int             i;
 
-    w = pixmap.width();
-    h = pixmap.height();
+    w = image.width();
+    h = image.height();
     hxa = font_metrics.height() + 5;    // height of X axis
     y = h - hxa;
     pixperdiv = (float) w / (float) m_HorDivs;
@@ -572,19 +773,13 @@ bool CPlotter::saveWaterfall(const QString & filename) const
     rect.setRect(w - pixperdiv - 10, y, pixperdiv, hxa);
     painter.drawText(rect, Qt::AlignRight|Qt::AlignBottom, tr("MHz"));
 
-    quint64 msec;
     int tdivs = h / 70 + 1;
     pixperdiv = (float) h / (float) tdivs;
     tt.setTimeSpec(Qt::OffsetFromUTC);
     for (i = 1; i < tdivs; i++)
     {
         y = (int)((float)i * pixperdiv);
-        if (msec_per_wfline > 0)
-            msec =  tlast_wf_ms - y * msec_per_wfline;
-        else
-            msec =  tlast_wf_ms - y * 1000 / fft_rate;
-
-        tt.setMSecsSinceEpoch(msec);
+        tt.setMSecsSinceEpoch(line_ms[y]);
         rect.setRect(0, y - font_metrics.height(), wya - 5, font_metrics.height());
         painter.drawText(rect, Qt::AlignRight|Qt::AlignVCenter, tt.toString("yyyy.MM.dd"));
         painter.drawLine(wya - 5, y, wya, y);
@@ -592,18 +787,28 @@ bool CPlotter::saveWaterfall(const QString & filename) const
         painter.drawText(rect, Qt::AlignRight|Qt::AlignVCenter, tt.toString("hh:mm:ss"));
     }
 
-    return pixmap.save(filename, 0, -1);
+    return image.save(filename, 0, -1);
 }
 
 /** Get waterfall time resolution in milleconds / line. */
 quint64 CPlotter::getWfTimeRes(void)
 {
+    QMutexLocker locker(&m_WfMutex);
+
     if (msec_per_wfline)
         return msec_per_wfline;
     else
         return 1000 / fft_rate; // Auto mode
 }
 
+/** Get the number of waterfall lines the history can hold, 0 if disabled. */
+int CPlotter::getWfHistoryLines(void)
+{
+    QMutexLocker locker(&m_WfMutex);
+
+    return m_WfHistory.capacity();
+}
+
 void CPlotter::setFftRate(int rate_hz)
 {
     fft_rate = rate_hz;
@@ -639,12 +844,10 @@ void CPlotter::mousePressEvent(QMouseEvent * event)
         {
             if (event->buttons() == Qt::LeftButton)
             {
-                int     best = -1;
+                qint64  peak_freq;
 
-                if (m_PeakDetection > 0)
-                    best = getNearestPeak(pt);
-                if (best != -1)
-                    m_DemodCenterFreq = freqFromX(best);
+                if (m_PeakDetection && getNearestPeak(pt, peak_freq))
+                    m_DemodCenterFreq = peak_freq;
                 else
                     m_DemodCenterFreq = roundFreq(freqFromX(pt.x()), m_ClickResolution);
 
@@ -706,7 +909,7 @@ void CPlotter::mouseReleaseEvent(QMouseEvent * event)
 {
     QPoint pt = event->pos();
 
-    if (!m_OverlayPixmap.rect().contains(pt))
+    if (!m_OverlayImage.rect().contains(pt))
     {
         // not in Overlay region
         if (NOCAP != m_CursorCaptured)
@@ -738,7 +941,7 @@ void CPlotter::zoomStepX(float step, int x)
     float new_range = qBound(10.0f, m_Span * step, m_SampleFreq * 10.0f);
 
     // Frequency where event occured is kept fixed under mouse
-    float ratio = (float)x / (float)m_OverlayPixmap.width();
+    float ratio = (float)x / (float)m_OverlayImage.width();
     float fixed_hz = freqFromX(x);
     float f_max = fixed_hz + (1.0 - ratio) * new_range;
     float f_min = f_max - new_range;
@@ -784,9 +987,9 @@ void CPlotter::wheelEvent(QWheelEvent * event)
         // Vertical zoom. Wheel down: zoom out, wheel up: zoom in
         // During zoom we try to keep the point (dB or kHz) under the cursor fixed
         float zoom_fac = event->delta() < 0 ? 1.1 : 0.9;
-        float ratio = (float)pt.y() / (float)m_OverlayPixmap.height();
+        float ratio = (float)pt.y() / (float)m_OverlayImage.height();
         float db_range = m_PandMaxdB - m_PandMindB;
-        float y_range = (float)m_OverlayPixmap.height();
+        float y_range = (float)m_OverlayImage.height();
         float db_per_pix = db_range / y_range;
         float fixed_db = m_PandMaxdB - pt.y() * db_per_pix;
 
@@ -804,6 +1007,23 @@ void CPlotter::wheelEvent(QWheelEvent * event)
     {
         zoomStepX(event->delta() < 0 ? 1.1 : 0.9, pt.x());
     }
+    else if ((event->modifiers() & Qt::AltModifier) &&
+             pt.y() >= m_OverlayImage.height())
+    {
+        // scroll the waterfall through the history, wheel up shows older lines
+        QMutexLocker locker(&m_WfMutex);
+
+        if (m_WfHistory.isOpen())
+        {
+            int step = qMax(m_WaterfallImage.height() / 10, 1);
+
+            m_WfScroll += (event->delta() > 0 ? step : -step);
+            m_WfScroll = qBound(0, m_WfScroll, qMax(m_WfHistory.rows() - 1, 0));
+            redrawWaterfall();
+        }
+        update();
+        return;
+    }
     else if (event->modifiers() & Qt::ControlModifier)
     {
         // filter width
@@ -845,29 +1065,37 @@ void CPlotter::resizeEvent(QResizeEvent* )
 
         m_Size = size();
         fft_plot_height = m_Percent2DScreen * m_Size.height() / 100;
-        m_OverlayPixmap = QPixmap(m_Size.width(), fft_plot_height);
-        m_OverlayPixmap.fill(Qt::black);
-        m_2DPixmap = QPixmap(m_Size.width(), fft_plot_height);
-        m_2DPixmap.fill(Qt::black);
+        m_OverlayImage = QImage(m_Size.width(), fft_plot_height,
+                                QImage::Format_RGB32);
+        m_OverlayImage.fill(Qt::black);
+
+        // the old spectrum layer does not fit anymore
+        m_FrontMutex.lock();
+        m_2DImage = QImage();
+        m_FrontMutex.unlock();
 
+        QMutexLocker wf_lock(&m_WfMutex);
         int height = m_Size.height() - fft_plot_height;
-        if (m_WaterfallPixmap.isNull())
+        if (m_WaterfallImage.isNull() || height <= 0 || m_WfHistory.isOpen())
         {
-            m_WaterfallPixmap = QPixmap(m_Size.width(), height);
-            m_WaterfallPixmap.fill(Qt::black);
+            m_WaterfallImage = QImage(m_Size.width(), qMax(height, 0), QImage::Format_RGB32);
+            m_WaterfallImage.fill(Qt::black);
         }
         else
         {
-            m_WaterfallPixmap = m_WaterfallPixmap.scaled(m_Size.width(), height,
-                                                         Qt::IgnoreAspectRatio,
-                                                         Qt::SmoothTransformation);
+            m_WaterfallImage = waterfallImage().scaled(m_Size.width(), height,
+                                                       Qt::IgnoreAspectRatio,
+                                                       Qt::SmoothTransformation)
+                                               .convertToFormat(QImage::Format_RGB32);
         }
+        m_WfLine = 0;
 
         m_PeakHoldValid = false;
 
         if (wf_span > 0)
             msec_per_wfline = wf_span / height;
         memset(m_wfbuf, 255, MAX_SCREENSIZE);
+        redrawWaterfall();
     }
 
     drawOverlay();
@@ -878,34 +1106,109 @@ void CPlotter::resizeEvent(QResizeEvent* )
 void CPlotter::paintEvent(QPaintEvent *)
 {
     QPainter painter(this);
+    int      y0 = m_Percent2DScreen * m_Size.height() / 100;
+
+    // the spectrum layer is composited over the cached overlay
+    painter.drawImage(0, 0, m_OverlayImage);
+    if (m_Running)
+    {
+        m_FrontMutex.lock();
+        painter.drawImage(0, 0, m_2DImage);
+        m_FrontMutex.unlock();
+    }
+
+    QMutexLocker locker(&m_WfMutex);
+    int      w = m_WaterfallImage.width();
+    int      h = m_WaterfallImage.height();
 
-    painter.drawPixmap(0, 0, m_2DPixmap);
-    painter.drawPixmap(0, m_Percent2DScreen * m_Size.height() / 100,
-                       m_WaterfallPixmap);
+    // the waterfall is a ring buffer with the newest line at m_WfLine
+    painter.drawImage(QPoint(0, y0), m_WaterfallImage,
+                      QRect(0, m_WfLine, w, h - m_WfLine));
+    if (m_WfLine > 0)
+        painter.drawImage(QPoint(0, y0 + h - m_WfLine), m_WaterfallImage,
+                          QRect(0, 0, w, m_WfLine));
 }
 
-// Called to update spectrum data for displaying on the screen
+// Called to update spectrum data for displaying on the screen. The frame
+// is handed over to the render thread, which draws it in renderFrame().
 void CPlotter::draw()
 {
-    int     i, n;
-    int     w;
-    int     h;
-    int     xmin, xmax;
-
     if (m_DrawOverlay)
     {
         drawOverlay();
         m_DrawOverlay = false;
     }
 
-    QPoint LineBuf[MAX_SCREENSIZE];
-
-    if (!m_Running)
+    if (!m_Running || m_fftDataSize <= 0)
         return;
 
+    QMutexLocker locker(&m_RenderMutex);
+
+    // a pending job that has not been drawn yet is simply replaced
+    m_Job.fftData.assign(m_fftData, m_fftData + m_fftDataSize);
+    m_Job.wfData.assign(m_wfData, m_wfData + m_fftDataSize);
+    m_Job.size = m_fftDataSize;
+    m_Job.centerFreq = m_CenterFreq;
+    m_Job.dataCenter = m_fftDataCenter;
+    m_Job.dataBw = m_fftDataBw > 0.f ? m_fftDataBw : m_SampleFreq;
+    m_Job.startFreq = m_FftCenter - (qint64)m_Span / 2;
+    m_Job.stopFreq = m_FftCenter + (qint64)m_Span / 2;
+    m_Job.pandMaxdB = m_PandMaxdB;
+    m_Job.pandMindB = m_PandMindB;
+    m_Job.wfMaxdB = m_WfMaxdB;
+    m_Job.wfMindB = m_WfMindB;
+    m_Job.plotSize = m_OverlayImage.size();
+    m_Job.fftColor = m_FftColor;
+    m_Job.fftFillCol = m_FftFillCol;
+    m_Job.peakHoldColor = m_PeakHoldColor;
+    m_Job.fftFill = m_FftFill;
+    m_Job.peakHold = m_PeakHoldActive;
+    m_Job.peakHoldReset = (m_JobPending && m_Job.peakHoldReset) || !m_PeakHoldValid;
+    m_Job.markers = m_Signals;
+    m_PeakHoldValid = true;
+
+    m_JobPending = true;
+    m_RenderCond.wakeOne();
+}
+
+// Main loop of the render thread
+void CPlotter::renderLoop()
+{
+    RenderJob   job;
+
+    QMutexLocker locker(&m_RenderMutex);
+    for (;;)
+    {
+        while (!m_JobPending && !m_RenderQuit)
+            m_RenderCond.wait(&m_RenderMutex);
+
+        if (m_RenderQuit)
+            return;
+
+        // swap keeps the buffers of both jobs allocated
+        std::swap(job, m_Job);
+        m_JobPending = false;
+
+        locker.unlock();
+        renderFrame(job);
+        locker.relock();
+    }
+}
+
+// Draw a new frame into the waterfall and the 2D back buffer (render thread)
+void CPlotter::renderFrame(const RenderJob &job)
+{
+    int     i, n;
+    int     w;
+    int     h;
+    int     xmin, xmax;
+    static QPoint LineBuf[MAX_SCREENSIZE + 2];  // only used by the render thread
+
     // get/draw the waterfall
-    w = m_WaterfallPixmap.width();
-    h = m_WaterfallPixmap.height();
+    m_WfMutex.lock();
+    w = m_WaterfallImage.width();
+    h = m_WaterfallImage.height();
+    m_WfMutex.unlock();
 
     // no need to draw if pixmap is invisible
     if (w != 0 && h != 0)
@@ -914,74 +1217,148 @@ void CPlotter::draw()
 
         // get scaled FFT data
         n = qMin(w, MAX_SCREENSIZE);
-        getScreenIntegerFFTData(255, n, m_WfMaxdB, m_WfMindB,
-                                m_FftCenter - (qint64)m_Span / 2,
-                                m_FftCenter + (qint64)m_Span / 2,
-                                m_wfData, m_fftbuf,
+        getScreenIntegerFFTData(job, 255, n, job.wfMaxdB, job.wfMindB,
+                                job.wfData.data(), m_fftbuf,
                                 &xmin, &xmax);
 
-        if (msec_per_wfline > 0)
+        bool        hist_row = false;
+        qint64      hist_center = 0;
+        float       hist_bw = 0.f;
+
+        QMutexLocker wf_lock(&m_WfMutex);
+
+        // skip the line if the waterfall has been resized meanwhile
+        if (w == m_WaterfallImage.width() && h == m_WaterfallImage.height())
         {
-            // not in "auto" mode, so accumulate waterfall data
-            for (i = 0; i < n; i++)
+            if (msec_per_wfline > 0)
             {
-                // average
-                //m_wfbuf[i] = (m_wfbuf[i] + m_fftbuf[i]) / 2;
+                // not in "auto" mode, so accumulate waterfall data
+                for (i = 0; i < n; i++)
+                {
+                    // average
+                    //m_wfbuf[i] = (m_wfbuf[i] + m_fftbuf[i]) / 2;
 
-                // peak (0..255 where 255 is min)
-                if (m_fftbuf[i] < m_wfbuf[i])
-                    m_wfbuf[i] = m_fftbuf[i];
+                    // peak (0..255 where 255 is min)
+                    if (m_fftbuf[i] < m_wfbuf[i])
+                        m_wfbuf[i] = m_fftbuf[i];
+                }
             }
-        }
 
-        // is it time to update waterfall?
-        if (tnow_ms - tlast_wf_ms >= msec_per_wfline)
-        {
-            tlast_wf_ms = tnow_ms;
+            // the history and the log keep the peak of the raw data
+            // between lines
+            bool keep_raw = m_WfHistory.isOpen() || m_WfLogger.isLogging();
 
-            // move current data down one line(must do before attaching a QPainter object)
-            m_WaterfallPixmap.scroll(0, 1, 0, 0, w, h);
+            if (keep_raw)
+            {
+                qint64 center = job.centerFreq + job.dataCenter;
 
-            QPainter painter1(&m_WaterfallPixmap);
+                if (!m_WfHistAccValid || m_WfHistAccCenter != center ||
+                    m_WfHistAccBw != job.dataBw ||
+                    m_WfHistAcc.size() != job.wfData.size())
+                {
+                    m_WfHistAcc = job.wfData;
+                    m_WfHistAccCenter = center;
+                    m_WfHistAccBw = job.dataBw;
+                    m_WfHistAccValid = true;
+                }
+                else
+                {
+                    volk_32f_x2_max_32f(m_WfHistAcc.data(), m_WfHistAcc.data(),
+                                        job.wfData.data(), job.size);
+                }
+            }
 
-            // draw new line of fft data at top of waterfall bitmap
-            painter1.setPen(QColor(0, 0, 0));
-            for (i = 0; i < xmin; i++)
-                painter1.drawPoint(i, 0);
-            for (i = xmax; i < w; i++)
-                painter1.drawPoint(i, 0);
+            // is it time to update waterfall?
+            bool new_line = (tnow_ms - tlast_wf_ms >= msec_per_wfline);
 
-            if (msec_per_wfline > 0)
+            if (new_line)
             {
-                // user set time span
-                for (i = xmin; i < xmax; i++)
+                tlast_wf_ms = tnow_ms;
+
+                if (keep_raw)
                 {
-                    painter1.setPen(m_ColorTbl[255 - m_wfbuf[i]]);
-                    painter1.drawPoint(i, 0);
-                    m_wfbuf[i] = 255;
+                    m_WfLogger.addRow(tnow_ms, m_WfHistAccCenter, m_WfHistAccBw,
+                                      m_WfHistAcc.data(), m_WfHistAcc.size(),
+                                      job.wfMindB, job.wfMaxdB, m_ColorTbl);
+                    if (m_WfHistory.isOpen())
+                    {
+                        // the row is written below without m_WfMutex
+                        m_WfHistory.beginRow();
+                        m_WfHistRow.swap(m_WfHistAcc);
+                        hist_center = m_WfHistAccCenter;
+                        hist_bw = m_WfHistAccBw;
+                        hist_row = true;
+                    }
+                    m_WfHistAccValid = false;
                 }
             }
-            else
+
+            if (new_line && m_WfScroll > 0)
+            {
+                // the user is looking at older lines; keep the view where
+                // it is and only reset the accumulator
+                memset(m_wfbuf, 255, MAX_SCREENSIZE);
+            }
+            else if (new_line)
             {
-                for (i = xmin; i < xmax; i++)
+                // the new line replaces the oldest one, which is just above
+                // the current top line in the ring buffer
+                m_WfLine = (m_WfLine + h - 1) % h;
+                QRgb *line = (QRgb *)m_WaterfallImage.scanLine(m_WfLine);
+
+                for (i = 0; i < xmin; i++)
+                    line[i] = qRgb(0, 0, 0);
+                for (i = xmax; i < w; i++)
+                    line[i] = qRgb(0, 0, 0);
+
+                if (msec_per_wfline > 0)
                 {
-                    painter1.setPen(m_ColorTbl[255 - m_fftbuf[i]]);
-                    painter1.drawPoint(i, 0);
+                    // user set time span
+                    for (i = xmin; i < xmax; i++)
+                    {
+                        line[i] = m_ColorTbl[255 - m_wfbuf[i]];
+                        m_wfbuf[i] = 255;
+                    }
+                }
+                else
+                {
+                    for (i = xmin; i < xmax; i++)
+                        line[i] = m_ColorTbl[255 - m_fftbuf[i]];
                 }
             }
         }
+        wf_lock.unlock();
+
+        // Writing to the history file may page in parts of it; paintEvent()
+        // must not wait for that on m_WfMutex.
+        if (hist_row)
+        {
+            QMutexLocker hist_lock(&m_WfHistMutex);
+
+            m_WfHistory.writeRow(tnow_ms, hist_center, hist_bw,
+                                 m_WfHistRow.data(), m_WfHistRow.size());
+
+            wf_lock.relock();
+            m_WfHistory.commitRow();
+            if (m_WfScroll > 0)
+                m_WfScroll = qMin(m_WfScroll + 1, m_WfHistory.rows() - 1);
+        }
     }
 
     // get/draw the 2D spectrum
-    w = m_2DPixmap.width();
-    h = m_2DPixmap.height();
+    w = job.plotSize.width();
+    h = job.plotSize.height();
 
     if (w != 0 && h != 0)
     {
-        // first copy into 2Dbitmap the overlay bitmap.
-        m_2DPixmap = m_OverlayPixmap.copy(0,0,w,h);
+        // the spectrum is drawn on its own layer, paintEvent() draws it
+        // over the overlay
+        if (m_2DBackImage.size() != job.plotSize)
+            m_2DBackImage = QImage(job.plotSize,
+                                   QImage::Format_ARGB32_Premultiplied);
+        m_2DBackImage.fill(Qt::transparent);
 
-        QPainter painter2(&m_2DPixmap);
+        QPainter painter2(&m_2DBackImage);
 
 // workaround for "fixed" line drawing since Qt 5
 // see http://stackoverflow.com/questions/16990326
@@ -990,86 +1367,77 @@ void CPlotter::draw()
 #endif
 
         // get new scaled fft data
-        getScreenIntegerFFTData(h, qMin(w, MAX_SCREENSIZE),
-                                m_PandMaxdB, m_PandMindB,
-                                m_FftCenter - (qint64)m_Span/2,
-                                m_FftCenter + (qint64)m_Span/2,
-                                m_fftData, m_fftbuf,
+        getScreenIntegerFFTData(job, h, qMin(w, MAX_SCREENSIZE),
+                                job.pandMaxdB, job.pandMindB,
+                                job.fftData.data(), m_fftbuf,
                                 &xmin, &xmax);
 
         // draw the pandapter
-        QBrush fillBrush = QBrush(m_FftFillCol);
         n = xmax - xmin;
         for (i = 0; i < n; i++)
         {
             LineBuf[i].setX(i + xmin);
             LineBuf[i].setY(m_fftbuf[i + xmin]);
-            if (m_FftFill)
-                painter2.fillRect(i + xmin, m_fftbuf[i + xmin], 1, h, fillBrush);
         }
 
-        painter2.setPen(m_FftColor);
+        // fill the area below the trace as a single polygon closed along
+        // the bottom edge of the plot
+        if (job.fftFill && n > 0)
+        {
+            LineBuf[n].setX(xmax - 1);
+            LineBuf[n].setY(h);
+            LineBuf[n + 1].setX(xmin);
+            LineBuf[n + 1].setY(h);
+            painter2.setPen(Qt::NoPen);
+            painter2.setBrush(job.fftFillCol);
+            painter2.drawPolygon(LineBuf, n + 2);
+            painter2.setBrush(Qt::NoBrush);
+        }
+
+        painter2.setPen(job.fftColor);
         painter2.drawPolyline(LineBuf, n);
 
-        // Peak detection
-        if (m_PeakDetection > 0)
+        // mark the signals found by the signal tracker
+        if (!job.markers.empty())
         {
-            m_Peaks.clear();
+            qint64  start = job.centerFreq + job.startFreq;
+            double  span = job.stopFreq - job.startFreq;
+            float   db_range = job.pandMaxdB - job.pandMindB;
 
-            float   mean = 0;
-            float   sum_of_sq = 0;
-            for (i = 0; i < n; i++)
+            for (i = 0; i < (int)job.markers.size(); i++)
             {
-                mean += m_fftbuf[i + xmin];
-                sum_of_sq += m_fftbuf[i + xmin] * m_fftbuf[i + xmin];
-            }
-            mean /= n;
-            float stdev= sqrt(sum_of_sq / n - mean * mean );
+                int x = (int)((job.markers[i].frequency - start) * w / span);
+                int y = (int)(h * (job.pandMaxdB - job.markers[i].level) / db_range);
 
-            int lastPeak = -1;
-            for (i = 0; i < n; i++)
-            {
-                //m_PeakDetection times the std over the mean or better than current peak
-                float d = (lastPeak == -1) ? (mean - m_PeakDetection * stdev) :
-                                           m_fftbuf[lastPeak + xmin];
-
-                if (m_fftbuf[i + xmin] < d)
-                    lastPeak=i;
-
-                if (lastPeak != -1 &&
-                        (i - lastPeak > PEAK_H_TOLERANCE || i == n-1))
-                {
-                    m_Peaks.insert(lastPeak + xmin, m_fftbuf[lastPeak + xmin]);
-                    painter2.drawEllipse(lastPeak + xmin - 5,
-                                         m_fftbuf[lastPeak + xmin] - 5, 10, 10);
-                    lastPeak = -1;
-                }
+                if (x >= 0 && x < w)
+                    painter2.drawEllipse(x - 5, y - 5, 10, 10);
             }
         }
 
         // Peak hold
-        if (m_PeakHoldActive)
+        if (job.peakHold)
         {
             for (i = 0; i < n; i++)
             {
-                if(!m_PeakHoldValid || m_fftbuf[i] < m_fftPeakHoldBuf[i])
+                if(job.peakHoldReset || m_fftbuf[i] < m_fftPeakHoldBuf[i])
                     m_fftPeakHoldBuf[i] = m_fftbuf[i];
 
                 LineBuf[i].setX(i + xmin);
                 LineBuf[i].setY(m_fftPeakHoldBuf[i + xmin]);
             }
-            painter2.setPen(m_PeakHoldColor);
+            painter2.setPen(job.peakHoldColor);
             painter2.drawPolyline(LineBuf, n);
-
-            m_PeakHoldValid = true;
         }
 
-      painter2.end();
+        painter2.end();
 
+        // publish the new frame
+        QMutexLocker front_lock(&m_FrontMutex);
+        m_2DImage.swap(m_2DBackImage);
     }
 
-    // trigger a new paintEvent
-    update();
+    // trigger a new paintEvent in the GUI thread
+    QMetaObject::invokeMethod(this, "update", Qt::QueuedConnection);
 }
 
 /**
@@ -1116,84 +1484,128 @@ void CPlotter::setNewFftData(float *fftData, float *wfData, int size)
     draw();
 }
 
-void CPlotter::getScreenIntegerFFTData(qint32 plotHeight, qint32 plotWidth,
+/**
+ * Update the cached mapping between FFT bins and pixels.
+ *
+ * The mapping only depends on the FFT size, the plot width and the visible
+ * bin range, so it is only recalculated when one of them changes.
+ */
+void CPlotter::updateBinMap(qint32 fftSize, qint32 plotWidth,
+                            qint32 binMin, qint32 binMax)
+{
+    qint32 i;
+    qint32 x;
+    qint32 xprev = -1;
+    qint32 minbin, maxbin;
+
+    if (fftSize == m_BinMapFftSize && plotWidth == m_BinMapWidth &&
+        binMin == m_BinMapMin && binMax == m_BinMapMax)
+        return;
+
+    m_BinMapFftSize = fftSize;
+    m_BinMapWidth = plotWidth;
+    m_BinMapMin = binMin;
+    m_BinMapMax = binMax;
+
+    minbin = binMin < 0 ? 0 : binMin;
+    maxbin = binMax < fftSize ? binMax : fftSize;
+    m_BinMapLarge = (binMax - binMin) > plotWidth; // true if more fft point than plot points
+    m_BinMap.resize(plotWidth + 1);
+
+    if (m_BinMapLarge)
+    {
+        // more FFT points than plot points: store the first bin of each
+        // pixel, the bins of a pixel end where the next pixel starts
+        m_BinMapXmin = 0;
+        m_BinMapXmax = 0;
+        for (i = minbin; i < maxbin; i++)
+        {
+            x = ((qint64)(i - binMin) * plotWidth) / (binMax - binMin);
+            if (x != xprev)
+            {
+                if (xprev < 0)
+                    m_BinMapXmin = x;
+                m_BinMap[x] = i;
+                xprev = x;
+            }
+        }
+        if (xprev >= 0)
+        {
+            m_BinMapXmax = xprev + 1;
+            m_BinMap[m_BinMapXmax] = maxbin;
+        }
+    }
+    else
+    {
+        // more plot points than FFT points
+        for (x = 0; x < plotWidth; x++)
+            m_BinMap[x] = binMin + (x * (binMax - binMin)) / plotWidth;
+        m_BinMapXmin = 0;
+        m_BinMapXmax = plotWidth;
+    }
+}
+
+void CPlotter::getScreenIntegerFFTData(const RenderJob &job,
+                                       qint32 plotHeight, qint32 plotWidth,
                                        float maxdB, float mindB,
-                                       qint64 startFreq, qint64 stopFreq,
-                                       float *inBuf, qint32 *outBuf,
+                                       const float *inBuf, qint32 *outBuf,
                                        int *xmin, int *xmax)
 {
     qint32 i;
+    qint32 n;
     qint32 y;
     qint32 x;
-    qint32 ymax = 10000;
-    qint32 xprev = -1;
-    qint32 minbin, maxbin;
     qint32 m_BinMin, m_BinMax;
-    qint32 m_FFTSize = m_fftDataSize;
-    float *m_pFFTAveBuf = inBuf;
+    qint32 m_FFTSize = job.size;
+    const float *m_pFFTAveBuf = inBuf;
     float  dBGainFactor = ((float)plotHeight) / fabs(maxdB - mindB);
-    qint32* m_pTranslateTbl = new qint32[qMax(m_FFTSize, plotWidth)];
+    float  peak;
+    uint32_t idx;
 
     /** FIXME: qint64 -> qint32 **/
-    m_BinMin = (qint32)((float)startFreq * (float)m_FFTSize / m_SampleFreq);
+    qint64 startFreq = job.startFreq - job.dataCenter;
+    qint64 stopFreq = job.stopFreq - job.dataCenter;
+    m_BinMin = (qint32)((float)startFreq * (float)m_FFTSize / job.dataBw);
     m_BinMin += (m_FFTSize/2);
-    m_BinMax = (qint32)((float)stopFreq * (float)m_FFTSize / m_SampleFreq);
+    m_BinMax = (qint32)((float)stopFreq * (float)m_FFTSize / job.dataBw);
     m_BinMax += (m_FFTSize/2);
 
-    minbin = m_BinMin < 0 ? 0 : m_BinMin;
     if (m_BinMin > m_FFTSize)
         m_BinMin = m_FFTSize - 1;
     if (m_BinMax <= m_BinMin)
         m_BinMax = m_BinMin + 1;
-    maxbin = m_BinMax < m_FFTSize ? m_BinMax : m_FFTSize;
-    bool largeFft = (m_BinMax-m_BinMin) > plotWidth; // true if more fft point than plot points
 
-    if (largeFft)
-    {
-        // more FFT points than plot points
-        for (i = minbin; i < maxbin; i++)
-            m_pTranslateTbl[i] = ((qint64)(i-m_BinMin)*plotWidth) / (m_BinMax - m_BinMin);
-        *xmin = m_pTranslateTbl[minbin];
-        *xmax = m_pTranslateTbl[maxbin - 1] + 1;
-    }
-    else
-    {
-        // more plot points than FFT points
-        for (i = 0; i < plotWidth; i++)
-            m_pTranslateTbl[i] = m_BinMin + (i*(m_BinMax - m_BinMin)) / plotWidth;
-        *xmin = 0;
-        *xmax = plotWidth;
-    }
+    updateBinMap(m_FFTSize, plotWidth, m_BinMin, m_BinMax);
+    *xmin = m_BinMapXmin;
+    *xmax = m_BinMapXmax;
 
-    if (largeFft)
+    if (m_BinMapLarge)
     {
-        // more FFT points than plot points
-        for (i = minbin; i < maxbin; i++ )
+        // more FFT points than plot points: show the peak of each pixel
+        for (x = m_BinMapXmin; x < m_BinMapXmax; x++)
         {
-            y = (qint32)(dBGainFactor*(maxdB-m_pFFTAveBuf[i]));
+            i = m_BinMap[x];
+            n = m_BinMap[x + 1] - i;
+            if (n > 8)
+            {
+                volk_32f_index_max_32u(&idx, m_pFFTAveBuf + i, n);
+                peak = m_pFFTAveBuf[i + idx];
+            }
+            else
+            {
+                peak = m_pFFTAveBuf[i];
+                while (--n > 0)
+                    peak = qMax(peak, m_pFFTAveBuf[++i]);
+            }
+
+            y = (qint32)(dBGainFactor*(maxdB-peak));
 
             if (y > plotHeight)
                 y = plotHeight;
             else if (y < 0)
                 y = 0;
 
-            x = m_pTranslateTbl[i];	//get fft bin to plot x coordinate transform
-
-            if (x == xprev)   // still mappped to same fft bin coordinate
-            {
-                if (y < ymax) // store only the max value
-                {
-                    outBuf[x] = y;
-                    ymax = y;
-                }
-
-            }
-            else
-            {
-                outBuf[x] = y;
-                xprev = x;
-                ymax = y;
-            }
+            outBuf[x] = y;
         }
     }
     else
@@ -1201,7 +1613,7 @@ void CPlotter::getScreenIntegerFFTData(qint32 plotHeight, qint32 plotWidth,
         // more plot points than FFT points
         for (x = 0; x < plotWidth; x++ )
         {
-            i = m_pTranslateTbl[x]; // get plot to fft bin coordinate transform
+            i = m_BinMap[x]; // get plot to fft bin coordinate transform
             if(i < 0 || i >= m_FFTSize)
                 y = plotHeight;
             else
@@ -1215,8 +1627,6 @@ void CPlotter::getScreenIntegerFFTData(qint32 plotHeight, qint32 plotWidth,
             outBuf[x] = y;
         }
     }
-
-    delete [] m_pTranslateTbl;
 }
 
 void CPlotter::setFftRange(float min, float max)
@@ -1244,17 +1654,106 @@ void CPlotter::setWaterfallRange(float min, float max)
     m_WfMindB = min;
     m_WfMaxdB = max;
     // no overlay change is necessary
+
+    if (m_WfHistory.isOpen())
+    {
+        m_WfMutex.lock();
+        redrawWaterfall();
+        m_WfMutex.unlock();
+        update();
+    }
 }
 
 // Called to draw an overlay bitmap containing grid and text that
 // does not need to be recreated every fft data update.
+#define HOR_MARGIN 5
+#define VER_MARGIN 5
+
+// The overlay is composed from cached layers:
+//  - grid layer: background, center line, frequency and level grid, axes
+//  - bookmark layer: bookmark tags (transparent background)
+//  - marker layer: demod filter box, drawn directly on the overlay
+// A layer is only redrawn when the parameters it depends on have changed,
+// so moving the demodulator or the filter just repaints the filter box.
+// The spectrum itself is a separate transparent layer drawn by the render
+// thread; paintEvent() draws it on top of the overlay.
 void CPlotter::drawOverlay()
 {
-    if (m_OverlayPixmap.isNull())
+    if (m_OverlayImage.isNull())
         return;
 
-    int     w = m_OverlayPixmap.width();
-    int     h = m_OverlayPixmap.height();
+    int     w = m_OverlayImage.width();
+    int     h = m_OverlayImage.height();
+    qint64  StartFreq = m_CenterFreq + m_FftCenter - m_Span / 2;
+    bool    recompose = false;
+
+    OverlayKey grid_key = {
+        w, h, StartFreq, m_Span, m_PandMindB, m_PandMaxdB,
+        m_CenterLineEnabled ? m_CenterFreq : -1,
+        m_FreqUnits, m_FreqDigits, m_VdivDelta
+    };
+    if (m_GridLayer.isNull() || !(grid_key == m_GridKey))
+    {
+        drawGridLayer(w, h);
+        m_GridKey = grid_key;
+        recompose = true;
+    }
+
+    OverlayKey bm_key = {
+        w, h, StartFreq, m_Span, 0.f, 0.f,
+        m_BookmarksEnabled ? 1 : 0, 0, 0, 0
+    };
+    if (m_BookmarksDirty || !(bm_key == m_BookmarkKey))
+    {
+        drawBookmarkLayer(w, h);
+        m_BookmarkKey = bm_key;
+        m_BookmarksDirty = false;
+        recompose = true;
+    }
+
+    if (recompose || m_StaticOverlay.size() != m_OverlayImage.size())
+    {
+        m_StaticOverlay = m_GridLayer.copy();
+        if (m_BookmarksEnabled && !m_BookmarkLayer.isNull())
+        {
+            QPainter painter(&m_StaticOverlay);
+            painter.drawImage(0, 0, m_BookmarkLayer);
+        }
+    }
+
+    // shallow copy, detached below only if there is something to draw on it
+    m_OverlayImage = m_StaticOverlay;
+
+    // Draw demod filter box
+    if (m_FilterBoxEnabled)
+    {
+        QPainter painter(&m_OverlayImage);
+
+        m_DemodFreqX = xFromFreq(m_DemodCenterFreq);
+        m_DemodLowCutFreqX = xFromFreq(m_DemodCenterFreq + m_DemodLowCutFreq);
+        m_DemodHiCutFreqX = xFromFreq(m_DemodCenterFreq + m_DemodHiCutFreq);
+
+        int dw = m_DemodHiCutFreqX - m_DemodLowCutFreqX;
+
+        painter.setOpacity(0.3);
+        painter.fillRect(m_DemodLowCutFreqX, 0, dw, h,
+                         QColor(PLOTTER_FILTER_BOX_COLOR));
+
+        painter.setOpacity(1.0);
+        painter.setPen(QColor(PLOTTER_FILTER_LINE_COLOR));
+        painter.drawLine(m_DemodFreqX, 0, m_DemodFreqX, h);
+    }
+
+    if (!m_Running)
+    {
+        // no spectrum is drawn while not running, show the new overlay
+        update();
+    }
+}
+
+/** Draw background, center line, grid and axes into m_GridLayer. */
+void CPlotter::drawGridLayer(int w, int h)
+{
     int     x,y;
     float   pixperdiv;
     float   adjoffset;
@@ -1262,7 +1761,11 @@ void CPlotter::drawOverlay()
     float   mindbadj;
     QRect   rect;
     QFontMetrics    metrics(m_Font);
-    QPainter        painter(&m_OverlayPixmap);
+
+    if (m_GridLayer.size() != QSize(w, h))
+        m_GridLayer = QImage(w, h, QImage::Format_RGB32);
+
+    QPainter        painter(&m_GridLayer);
 
     painter.initFrom(this);
     painter.setFont(m_Font);
@@ -1271,9 +1774,6 @@ void CPlotter::drawOverlay()
     painter.setBrush(Qt::SolidPattern);
     painter.fillRect(0, 0, w, h, QColor(PLOTTER_BGD_COLOR));
 
-#define HOR_MARGIN 5
-#define VER_MARGIN 5
-
     // X and Y axis areas
     m_YAxisWidth = metrics.width("XXXX") + 2 * HOR_MARGIN;
     m_XAxisYCenter = h - metrics.height()/2;
@@ -1281,60 +1781,6 @@ void CPlotter::drawOverlay()
     int xAxisTop = h - xAxisHeight;
     int fLabelTop = xAxisTop + VER_MARGIN;
 
-    if (m_BookmarksEnabled)
-    {
-        m_BookmarkTags.clear();
-        static const QFontMetrics fm(painter.font());
-        static const int fontHeight = fm.ascent() + 1;
-        static const int slant = 5;
-        static const int levelHeight = fontHeight + 5;
-        static const int nLevels = 10;
-        QList<BookmarkInfo> bookmarks = Bookmarks::Get().getBookmarksInRange(m_CenterFreq + m_FftCenter - m_Span / 2,
-                                                                             m_CenterFreq + m_FftCenter + m_Span / 2);
-        int tagEnd[nLevels] = {0};
-        for (int i = 0; i < bookmarks.size(); i++)
-        {
-            x = xFromFreq(bookmarks[i].frequency);
-
-#if defined(_WIN16) || defined(_WIN32) || defined(_WIN64)
-            int nameWidth = fm.width(bookmarks[i].name);
-#else
-            int nameWidth = fm.boundingRect(bookmarks[i].name).width();
-#endif
-
-            int level = 0;
-            while(level < nLevels && tagEnd[level] > x)
-                level++;
-
-            if(level == nLevels)
-                level = 0;
-
-            tagEnd[level] = x + nameWidth + slant - 1;
-            m_BookmarkTags.append(qMakePair<QRect, qint64>(QRect(x, level * levelHeight, nameWidth + slant, fontHeight), bookmarks[i].frequency));
-
-            QColor color = QColor(bookmarks[i].GetColor());
-            color.setAlpha(0x60);
-            // Vertical line
-            painter.setPen(QPen(color, 1, Qt::DashLine));
-            painter.drawLine(x, level * levelHeight + fontHeight + slant, x, xAxisTop);
-
-            // Horizontal line
-            painter.setPen(QPen(color, 1, Qt::SolidLine));
-            painter.drawLine(x + slant, level * levelHeight + fontHeight,
-                             x + nameWidth + slant - 1,
-                             level * levelHeight + fontHeight);
-            // Diagonal line
-            painter.drawLine(x + 1, level * levelHeight + fontHeight + slant - 1,
-                             x + slant - 1, level * levelHeight + fontHeight + 1);
-
-            color.setAlpha(0xFF);
-            painter.setPen(QPen(color, 2, Qt::SolidLine));
-            painter.drawText(x + slant, level * levelHeight, nameWidth,
-                             fontHeight, Qt::AlignVCenter | Qt::AlignHCenter,
-                             bookmarks[i].name);
-        }
-    }
-
     if (m_CenterLineEnabled)
     {
         x = xFromFreq(m_CenterFreq);
@@ -1421,37 +1867,97 @@ void CPlotter::drawOverlay()
         }
     }
 
-    // Draw demod filter box
-    if (m_FilterBoxEnabled)
+    painter.end();
+}
+
+/** Draw the bookmark tags into m_BookmarkLayer and update m_BookmarkTags. */
+void CPlotter::drawBookmarkLayer(int w, int h)
+{
+    m_BookmarkTags.clear();
+
+    if (!m_BookmarksEnabled)
     {
-        m_DemodFreqX = xFromFreq(m_DemodCenterFreq);
-        m_DemodLowCutFreqX = xFromFreq(m_DemodCenterFreq + m_DemodLowCutFreq);
-        m_DemodHiCutFreqX = xFromFreq(m_DemodCenterFreq + m_DemodHiCutFreq);
+        m_BookmarkLayer = QImage();
+        return;
+    }
 
-        int dw = m_DemodHiCutFreqX - m_DemodLowCutFreqX;
+    if (m_BookmarkLayer.size() != QSize(w, h))
+        m_BookmarkLayer = QImage(w, h, QImage::Format_ARGB32_Premultiplied);
+    m_BookmarkLayer.fill(Qt::transparent);
 
-        painter.setOpacity(0.3);
-        painter.fillRect(m_DemodLowCutFreqX, 0, dw, h,
-                         QColor(PLOTTER_FILTER_BOX_COLOR));
+    int     x;
+    QFontMetrics    metrics(m_Font);
+    QPainter        painter(&m_BookmarkLayer);
 
-        painter.setOpacity(1.0);
-        painter.setPen(QColor(PLOTTER_FILTER_LINE_COLOR));
-        painter.drawLine(m_DemodFreqX, 0, m_DemodFreqX, h);
-    }
+    painter.initFrom(this);
+    painter.setFont(m_Font);
 
-    if (!m_Running)
+    int xAxisTop = h - metrics.height() - 2 * VER_MARGIN;
+
+    static const QFontMetrics fm(painter.font());
+    static const int fontHeight = fm.ascent() + 1;
+    static const int slant = 5;
+    static const int levelHeight = fontHeight + 5;
+    static const int nLevels = 10;
+    Bookmarks &bm = Bookmarks::Get();
+    int first = bm.lowerBound(m_CenterFreq + m_FftCenter - m_Span / 2);
+    int last = bm.upperBound(m_CenterFreq + m_FftCenter + m_Span / 2);
+    int tagEnd[nLevels] = {0};
+    for (int i = first; i < last; i++)
     {
-        // if not running so is no data updates to draw to screen
-        // copy into 2Dbitmap the overlay bitmap.
-        m_2DPixmap = m_OverlayPixmap.copy(0,0,w,h);
+        qint64 frequency = bm.frequencyAt(i);
+        const QString &name = bm.nameAt(i);
 
-        // trigger a new paintEvent
-        update();
+        x = xFromFreq(frequency);
+
+#if defined(_WIN16) || defined(_WIN32) || defined(_WIN64)
+        int nameWidth = fm.width(name);
+#else
+        int nameWidth = fm.boundingRect(name).width();
+#endif
+
+        int level = 0;
+        while(level < nLevels && tagEnd[level] > x)
+            level++;
+
+        if(level == nLevels)
+            level = 0;
+
+        tagEnd[level] = x + nameWidth + slant - 1;
+        m_BookmarkTags.append(qMakePair<QRect, qint64>(QRect(x, level * levelHeight, nameWidth + slant, fontHeight), frequency));
+
+        QColor color = QColor(bm.colorAt(i));
+        color.setAlpha(0x60);
+        // Vertical line
+        painter.setPen(QPen(color, 1, Qt::DashLine));
+        painter.drawLine(x, level * levelHeight + fontHeight + slant, x, xAxisTop);
+
+        // Horizontal line
+        painter.setPen(QPen(color, 1, Qt::SolidLine));
+        painter.drawLine(x + slant, level * levelHeight + fontHeight,
+                         x + nameWidth + slant - 1,
+                         level * levelHeight + fontHeight);
+        // Diagonal line
+        painter.drawLine(x + 1, level * levelHeight + fontHeight + slant - 1,
+                         x + slant - 1, level * levelHeight + fontHeight + 1);
+
+        color.setAlpha(0xFF);
+        painter.setPen(QPen(color, 2, Qt::SolidLine));
+        painter.drawText(x + slant, level * levelHeight, nameWidth,
+                         fontHeight, Qt::AlignVCenter | Qt::AlignHCenter,
+                         name);
     }
 
     painter.end();
 }
 
+/** Redraw the bookmark tags, e.g. after the bookmarks have been edited. */
+void CPlotter::updateBookmarks()
+{
+    m_BookmarksDirty = true;
+    updateOverlay();
+}
+
 // Create frequency division strings based on start frequency, span frequency,
 // and frequency units.
 // Places in QString array m_HDivText
@@ -1509,20 +2015,20 @@ void CPlotter::makeFrequencyStrs()
 // Convert from screen coordinate to frequency
 int CPlotter::xFromFreq(qint64 freq)
 {
-    int w = m_OverlayPixmap.width();
+    int w = m_OverlayImage.width();
     qint64 StartFreq = m_CenterFreq + m_FftCenter - m_Span/2;
     int x = (int) w * ((float)freq - StartFreq)/(float)m_Span;
     if (x < 0)
         return 0;
     if (x > (int)w)
-        return m_OverlayPixmap.width();
+        return m_OverlayImage.width();
     return x;
 }
 
 // Convert from frequency to screen coordinate
 qint64 CPlotter::freqFromX(int x)
 {
-    int w = m_OverlayPixmap.width();
+    int w = m_OverlayImage.width();
     qint64 StartFreq = m_CenterFreq + m_FftCenter - m_Span / 2;
     qint64 f = (qint64)(StartFreq + (float)m_Span * (float)x / (float)w);
     return f;
@@ -1532,10 +2038,22 @@ qint64 CPlotter::freqFromX(int x)
 quint64 CPlotter::msecFromY(int y)
 {
     // ensure we are in the waterfall region
-    if (y < m_OverlayPixmap.height())
+    if (y < m_OverlayImage.height())
         return 0;
 
-    int dy = y - m_OverlayPixmap.height();
+    int dy = y - m_OverlayImage.height();
+
+    QMutexLocker locker(&m_WfMutex);
+    return lineTime(dy);
+}
+
+/** Time stamp of a line on the waterfall (m_WfMutex held). */
+quint64 CPlotter::lineTime(int dy) const
+{
+    quint64 msec;
+
+    if (m_WfHistory.rowInfo(m_WfScroll + dy, &msec, 0, 0, 0))
+        return msec;
 
     if (msec_per_wfline > 0)
         return tlast_wf_ms - dy * msec_per_wfline;
@@ -1655,14 +2173,14 @@ void CPlotter::setPeakHold(bool enabled)
 /**
  * Set peak detection on or off.
  * @param enabled The new state of peak detection.
- * @param c Minimum distance of peaks from mean, in multiples of standard deviation.
+ *
+ * The peaks are provided by the signal tracker through setSignals().
  */
-void CPlotter::setPeakDetection(bool enabled, float c)
+void CPlotter::setPeakDetection(bool enabled)
 {
-    if(!enabled || c <= 0)
-        m_PeakDetection = -1;
-    else
-        m_PeakDetection = c;
+    m_PeakDetection = enabled;
+    if (!enabled)
+        m_Signals.clear();
 }
 
 void CPlotter::calcDivSize (qint64 low, qint64 high, int divswanted, qint64 &adjlow, qint64 &step, int& divs)
@@ -1821,6 +2339,7 @@ unsigned char plasma[256][3] = {
 
 void CPlotter::setWfColormap(const QString &cmap)
 {
+    QMutexLocker locker(&m_WfMutex);
     int i;
 
     if (cmap.compare("gqrx", Qt::CaseInsensitive) == 0)
@@ -1829,33 +2348,33 @@ void CPlotter::setWfColormap(const QString &cmap)
         {
             // level 0: black background
             if (i < 20)
-                m_ColorTbl[i].setRgb(0, 0, 0);
+                m_ColorTbl[i] = qRgb(0, 0, 0);
             // level 1: black -> blue
             else if ((i >= 20) && (i < 70))
-                m_ColorTbl[i].setRgb(0, 0, 140*(i-20)/50);
+                m_ColorTbl[i] = qRgb(0, 0, 140*(i-20)/50);
             // level 2: blue -> light-blue / greenish
             else if ((i >= 70) && (i < 100))
-                m_ColorTbl[i].setRgb(60*(i-70)/30, 125*(i-70)/30, 115*(i-70)/30 + 140);
+                m_ColorTbl[i] = qRgb(60*(i-70)/30, 125*(i-70)/30, 115*(i-70)/30 + 140);
             // level 3: light blue -> yellow
             else if ((i >= 100) && (i < 150))
-                m_ColorTbl[i].setRgb(195*(i-100)/50 + 60, 130*(i-100)/50 + 125, 255-(255*(i-100)/50));
+                m_ColorTbl[i] = qRgb(195*(i-100)/50 + 60, 130*(i-100)/50 + 125, 255-(255*(i-100)/50));
             // level 4: yellow -> red
             else if ((i >= 150) && (i < 250))
-                m_ColorTbl[i].setRgb(255, 255-255*(i-150)/100, 0);
+                m_ColorTbl[i] = qRgb(255, 255-255*(i-150)/100, 0);
             // level 5: red -> white
             else if (i >= 250)
-                m_ColorTbl[i].setRgb(255, 255*(i-250)/5, 255*(i-250)/5);
+                m_ColorTbl[i] = qRgb(255, 255*(i-250)/5, 255*(i-250)/5);
         }
     }
     else if (cmap.compare("turbo", Qt::CaseInsensitive) == 0)
     {
         for (i = 0; i < 256; i++)
-            m_ColorTbl[i].setRgb(turbo[i][0], turbo[i][1], turbo[i][2]);
+            m_ColorTbl[i] = qRgb(turbo[i][0], turbo[i][1], turbo[i][2]);
     }
     else if (cmap.compare("plasma",Qt::CaseInsensitive) == 0)
     {
         for (i = 0; i < 256; i++)
-            m_ColorTbl[i].setRgb(plasma[i][0], plasma[i][1], plasma[i][2]);
+            m_ColorTbl[i] = qRgb(plasma[i][0], plasma[i][1], plasma[i][2]);
     }
     else if (cmap.compare("whitehotcompressed",Qt::CaseInsensitive) == 0)
     {
@@ -1866,22 +2385,25 @@ void CPlotter::setWfColormap(const QString &cmap)
         {
             if (i < 64)
             {
-                m_ColorTbl[i].setRgb(i*4, i*4, i*4);
+                m_ColorTbl[i] = qRgb(i*4, i*4, i*4);
             }
             else
             {
-                m_ColorTbl[i].setRgb(255, 255, 255);
+                m_ColorTbl[i] = qRgb(255, 255, 255);
             }
         }
     }
     else if (cmap.compare("whitehot",Qt::CaseInsensitive) == 0)
     {
         for (i = 0; i < 256; i++)
-            m_ColorTbl[i].setRgb(i, i, i);
+            m_ColorTbl[i] = qRgb(i, i, i);
     }
     else if (cmap.compare("blackhot",Qt::CaseInsensitive) == 0)
     {
         for (i = 0; i < 256; i++)
-            m_ColorTbl[i].setRgb(255-i, 255-i, 255-i);
+            m_ColorTbl[i] = qRgb(255-i, 255-i, 255-i);
     }
+
+    redrawWaterfall();
+    update();
 }
@@ -6,8 +6,13 @@
 #include <QFont>
 #include <QFrame>
 #include <QImage>
+#include <QMutex>
+#include <QWaitCondition>
 #include <vector>
 #include <QMap>
+#include "waterfall_history.h"
+#include "waterfall_logger.h"
+#include "dsp/signal_tracker.h"
 
 #define HORZ_DIVS_MAX 12    //50
 #define VERT_DIVS_MIN 5
@@ -15,13 +20,15 @@
 
 #define PEAK_CLICK_MAX_H_DISTANCE 10 //Maximum horizontal distance of clicked point from peak
 #define PEAK_CLICK_MAX_V_DISTANCE 20 //Maximum vertical distance of clicked point from peak
-#define PEAK_H_TOLERANCE 2
 
+class CPlotterRenderThread;
 
 class CPlotter : public QFrame
 {
     Q_OBJECT
 
+    friend class CPlotterRenderThread;
+
 public:
     explicit CPlotter(QWidget *parent = 0);
     ~CPlotter();
@@ -30,7 +37,7 @@ public:
     QSize sizeHint() const;
 
     //void SetSdrInterface(CSdrInterface* ptr){m_pSdrInterface = ptr;}
-    void draw();		//call to draw new fft data onto screen plot
+    void draw();		//call to draw new fft data onto screen plot (in the render thread)
     void setRunningState(bool running) { m_Running = running; }
     void setClickResolution(int clickres) { m_ClickResolution = clickres; }
     void setFilterClickResolution(int clickres) { m_FilterClickResolution = clickres; }
@@ -113,12 +120,28 @@ public:
         m_FftCenter = qBound(-limit, f, limit);
     }
 
-    int     getNearestPeak(QPoint pt);
+    qint64 getFftCenterFreq(void) const { return m_FftCenter; }
+    qint64 getSpanFreq(void) const { return m_Span; }
+
+    /* Band covered by the FFT data, relative to SetCenterFreq(). A zero
+     * bandwidth means the data covers the full sample rate. */
+    void setFftDataRange(qint64 center, float bandwidth)
+    {
+        m_fftDataCenter = center;
+        m_fftDataBw = bandwidth;
+    }
+
+    bool    getNearestPeak(QPoint pt, qint64 &freq);
+    void    setSignals(const std::vector<tracked_signal> &sigs);
     void    setWaterfallSpan(quint64 span_ms);
     quint64 getWfTimeRes(void);
+    int     getWfHistoryLines(void);
     void    setFftRate(int rate_hz);
     void    clearWaterfall(void);
     bool    saveWaterfall(const QString & filename) const;
+    bool    setWaterfallHistory(const QString &filename, qint64 size);
+    bool    startWaterfallLog(const QString &dir);
+    quint64 stopWaterfallLog();
 
 signals:
     void newCenterFreq(qint64 f);
@@ -145,8 +168,9 @@ public slots:
     void setWfColormap(const QString &cmap);
     void setPandapterRange(float min, float max);
     void setWaterfallRange(float min, float max);
-    void setPeakDetection(bool enabled, float c);
+    void setPeakDetection(bool enabled);
     void updateOverlay();
+    void updateBookmarks();
 
     void setPercent2DScreen(int percent)
     {
@@ -175,42 +199,136 @@ private:
         BOOKMARK
     };
 
+    /* Parameters a cached overlay layer has been drawn with. */
+    struct OverlayKey {
+        int         width;
+        int         height;
+        qint64      startFreq;
+        qint64      span;
+        float       mindB, maxdB;
+        qint64      param;      /* layer specific, e.g. center line */
+        qint32      freqUnits;
+        int         freqDigits;
+        int         vdivDelta;
+
+        bool operator==(const OverlayKey &k) const
+        {
+            return width == k.width && height == k.height &&
+                   startFreq == k.startFreq && span == k.span &&
+                   mindB == k.mindB && maxdB == k.maxdB &&
+                   param == k.param && freqUnits == k.freqUnits &&
+                   freqDigits == k.freqDigits && vdivDelta == k.vdivDelta;
+        }
+    };
+
     void        drawOverlay();
+    void        drawGridLayer(int w, int h);
+    void        drawBookmarkLayer(int w, int h);
     void        makeFrequencyStrs();
     int         xFromFreq(qint64 freq);
     qint64      freqFromX(int x);
     void        zoomStepX(float factor, int x);
     qint64      roundFreq(qint64 freq, int resolution);
     quint64     msecFromY(int y);
+    quint64     lineTime(int dy) const;
     void        clampDemodParameters();
+    QImage      waterfallImage() const;
+    void        redrawWaterfall();
+
+    /* Everything the render thread needs to draw one frame. */
+    struct RenderJob {
+        std::vector<float>  fftData;
+        std::vector<float>  wfData;
+        int         size;
+        qint64      centerFreq;
+        qint64      dataCenter;
+        float       dataBw;
+        qint64      startFreq;
+        qint64      stopFreq;
+        float       pandMaxdB, pandMindB;
+        float       wfMaxdB, wfMindB;
+        QSize       plotSize;   /*! size of the 2D plot */
+        QColor      fftColor, fftFillCol, peakHoldColor;
+        bool        fftFill;
+        bool        peakHold;
+        bool        peakHoldReset;
+        std::vector<tracked_signal> markers;
+    };
+
+    void        renderLoop();
+    void        renderFrame(const RenderJob &job);
     bool        isPointCloseTo(int x, int xr, int delta)
     {
         return ((x > (xr - delta)) && (x < (xr + delta)));
     }
-    void getScreenIntegerFFTData(qint32 plotHeight, qint32 plotWidth,
+    void getScreenIntegerFFTData(const RenderJob &job,
+                                 qint32 plotHeight, qint32 plotWidth,
                                  float maxdB, float mindB,
-                                 qint64 startFreq, qint64 stopFreq,
-                                 float *inBuf, qint32 *outBuf,
+                                 const float *inBuf, qint32 *outBuf,
                                  qint32 *maxbin, qint32 *minbin);
+    void updateBinMap(qint32 fftSize, qint32 plotWidth, qint32 binMin, qint32 binMax);
     void calcDivSize (qint64 low, qint64 high, int divswanted, qint64 &adjlow, qint64 &step, int& divs);
 
     bool        m_PeakHoldActive;
     bool        m_PeakHoldValid;
     qint32      m_fftbuf[MAX_SCREENSIZE];
+
+    // bin to pixel mapping cached by updateBinMap()
+    std::vector<qint32> m_BinMap;  // first bin of each pixel (or the bin shown on it)
+    bool        m_BinMapLarge;     // more FFT bins than pixels
+    qint32      m_BinMapFftSize;
+    qint32      m_BinMapWidth;
+    qint32      m_BinMapMin;
+    qint32      m_BinMapMax;
+    int         m_BinMapXmin;
+    int         m_BinMapXmax;
     quint8      m_wfbuf[MAX_SCREENSIZE]; // used for accumulating waterfall data at high time spans
     qint32      m_fftPeakHoldBuf[MAX_SCREENSIZE];
     float      *m_fftData;     /*! pointer to incoming FFT data */
     float      *m_wfData;
     int         m_fftDataSize;
+    qint64      m_fftDataCenter; /*! center of the FFT data band */
+    float       m_fftDataBw;     /*! bandwidth of the FFT data, 0 is m_SampleFreq */
+
+    // Frames are drawn by m_RenderThread. m_RenderMutex protects the
+    // pending job, m_FrontMutex the finished 2D image, and
+    // m_WfMutex the waterfall ring, its timing and the colormap.
+    // m_WfHistMutex is taken before m_WfMutex while the render thread
+    // writes a history row and when the history file is opened or closed.
+    CPlotterRenderThread   *m_RenderThread;
+    QMutex          m_RenderMutex;
+    QWaitCondition  m_RenderCond;
+    RenderJob       m_Job;
+    bool            m_JobPending;
+    bool            m_RenderQuit;
+    mutable QMutex  m_FrontMutex;
+    QImage          m_2DBackImage;  /*! spectrum layer being drawn by the render thread */
+    mutable QMutex  m_WfMutex;
+    QMutex          m_WfHistMutex;
 
     int         m_XAxisYCenter;
     int         m_YAxisWidth;
 
     eCapturetype    m_CursorCaptured;
-    QPixmap     m_2DPixmap;
-    QPixmap     m_OverlayPixmap;
-    QPixmap     m_WaterfallPixmap;
-    QColor      m_ColorTbl[256];
+    QImage      m_2DImage;          /*! spectrum layer, transparent */
+    QImage      m_OverlayImage;
+    QImage      m_GridLayer;        /*! background, grid and axes */
+    QImage      m_BookmarkLayer;    /*! bookmark tags, transparent */
+    QImage      m_StaticOverlay;    /*! grid and bookmark layers composed */
+    OverlayKey  m_GridKey;
+    OverlayKey  m_BookmarkKey;
+    bool        m_BookmarksDirty;
+    QImage      m_WaterfallImage;   /*! ring buffer of waterfall lines */
+    int         m_WfLine;           /*! row of the newest waterfall line */
+    CWaterfallHistory   m_WfHistory;    /*! raw waterfall data, optional */
+    int         m_WfScroll;         /*! history rows scrolled back */
+    CWaterfallLogger    m_WfLogger;     /*! PNG strip archive, optional */
+    std::vector<float>  m_WfHistAcc;    /*! peak of the data for the next history row */
+    std::vector<float>  m_WfHistRow;    /*! row being written by the render thread */
+    qint64      m_WfHistAccCenter;
+    float       m_WfHistAccBw;
+    bool        m_WfHistAccValid;
+    QRgb        m_ColorTbl[256];
     QSize       m_Size;
     QString     m_Str;
     QString     m_HDivText[HORZ_DIVS_MAX+1];
@@ -267,8 +385,8 @@ private:
     QColor      m_FftColor, m_FftFillCol, m_PeakHoldColor;
     bool        m_FftFill;
 
-    float       m_PeakDetection;
-    QMap<int,int>   m_Peaks;
+    bool        m_PeakDetection;
+    std::vector<tracked_signal> m_Signals;  /*! signals marked on the pandapter */
 
     QList< QPair<QRect, qint64> >     m_BookmarkTags;
 
@@ -0,0 +1,282 @@
+/* -*- c++ -*- */
+/*
+ * Gqrx SDR: Software defined radio receiver powered by GNU Radio and Qt
+ *           http://gqrx.dk/
+ *
+ * Copyright 2011-2020 Alexandru Csete OZ9AEC.
+ *
+ * Gqrx is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Gqrx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Gqrx; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#include <cstring>
+#include <QDebug>
+#include "waterfall_history.h"
+
+#define WF_HISTORY_VERSION  1
+
+CWaterfallHistory::CWaterfallHistory() :
+    m_Data(0),
+    m_Header(0),
+    m_RowSize(sizeof(RowHeader) + WF_HISTORY_MAX_BINS * sizeof(quint16)),
+    m_Capacity(0),
+    m_Head(0),
+    m_Count(0)
+{
+}
+
+CWaterfallHistory::~CWaterfallHistory()
+{
+    close();
+}
+
+/**
+ * @brief Create the history file and map it into memory.
+ * @param filename The file to use. An existing file is overwritten.
+ * @param size The size of the file in bytes.
+ * @return TRUE if the file could be created and mapped.
+ */
+bool CWaterfallHistory::open(const QString &filename, qint64 size)
+{
+    close();
+
+    m_Capacity = (size - (qint64)sizeof(FileHeader)) / m_RowSize;
+    if (m_Capacity < 1)
+    {
+        m_Capacity = 0;
+        return false;
+    }
+
+    size = sizeof(FileHeader) + m_Capacity * m_RowSize;
+    m_File.setFileName(filename);
+    if (!m_File.open(QIODevice::ReadWrite | QIODevice::Truncate) ||
+        !m_File.resize(size))
+    {
+        qWarning() << "Can not create waterfall history" << filename
+                   << m_File.errorString();
+        m_File.close();
+        m_Capacity = 0;
+        return false;
+    }
+
+    m_Data = m_File.map(0, size);
+    if (!m_Data)
+    {
+        qWarning() << "Can not map waterfall history" << filename
+                   << m_File.errorString();
+        m_File.close();
+        m_Capacity = 0;
+        return false;
+    }
+
+    m_Header = (FileHeader *)m_Data;
+    memcpy(m_Header->magic, "GQRXWFH", 8);
+    m_Header->version = WF_HISTORY_VERSION;
+    m_Header->max_bins = WF_HISTORY_MAX_BINS;
+    m_Header->row_size = m_RowSize;
+    m_Header->capacity = m_Capacity;
+    clear();
+
+    return true;
+}
+
+void CWaterfallHistory::close()
+{
+    if (m_Data)
+    {
+        m_File.unmap(m_Data);
+        m_File.close();
+    }
+    m_Data = 0;
+    m_Header = 0;
+    m_Capacity = 0;
+    m_Head = 0;
+    m_Count = 0;
+}
+
+/** Drop all rows. */
+void CWaterfallHistory::clear()
+{
+    m_Head = 0;
+    m_Count = 0;
+    if (m_Header)
+    {
+        m_Header->head = 0;
+        m_Header->count = 0;
+    }
+}
+
+/**
+ * @brief Hide the slot of the next row from the readers.
+ *
+ * Appending a row is done in three steps so that the data can be written
+ * without holding the lock that protects the readers: beginRow() and
+ * commitRow() must be called with that lock held, writeRow() in between
+ * does not need it. When the history is full the oldest row is dropped
+ * here since its slot is about to be overwritten.
+ */
+void CWaterfallHistory::beginRow()
+{
+    if (m_Data && m_Count == m_Capacity)
+    {
+        m_Count--;
+        m_Header->count = m_Count;
+    }
+}
+
+/**
+ * @brief Write the next row into its slot, see beginRow().
+ * @param time_ms Time stamp of the row.
+ * @param center Absolute center frequency of the data.
+ * @param bandwidth Bandwidth covered by the data.
+ * @param data FFT data in dB, lowest frequency first.
+ * @param size Number of FFT bins in data.
+ *
+ * Data with more than WF_HISTORY_MAX_BINS bins is decimated keeping the
+ * peak value of each group of bins.
+ */
+void CWaterfallHistory::writeRow(quint64 time_ms, qint64 center,
+                                 float bandwidth, const float *data, int size)
+{
+    if (!m_Data || size <= 0)
+        return;
+
+    RowHeader  *hdr = (RowHeader *)(m_Data + sizeof(FileHeader) +
+                                    m_Head * m_RowSize);
+    quint16    *out = (quint16 *)(hdr + 1);
+    int         bins = qMin(size, WF_HISTORY_MAX_BINS);
+    int         i, j, k;
+
+    hdr->time_ms = time_ms;
+    hdr->center = center;
+    hdr->bandwidth = bandwidth;
+    hdr->bins = bins;
+
+    for (i = 0, j = 0; i < bins; i++)
+    {
+        int     end = (qint64)(i + 1) * size / bins;
+        float   peak = data[j];
+
+        for (k = j + 1; k < end; k++)
+            if (data[k] > peak)
+                peak = data[k];
+        j = end;
+
+        float q = (peak - WF_HISTORY_MIN_DB) * WF_HISTORY_DB_SCALE + 0.5f;
+        out[i] = (quint16)qBound(0.f, q, 65535.f);
+    }
+}
+
+/** Make the row written by writeRow() the newest one. */
+void CWaterfallHistory::commitRow()
+{
+    if (!m_Data)
+        return;
+
+    m_Head = (m_Head + 1) % m_Capacity;
+    if (m_Count < m_Capacity)
+        m_Count++;
+    m_Header->head = m_Head;
+    m_Header->count = m_Count;
+}
+
+const CWaterfallHistory::RowHeader *CWaterfallHistory::row(int age) const
+{
+    if (age < 0 || age >= m_Count)
+        return 0;
+
+    int slot = (m_Head - 1 - age + m_Capacity) % m_Capacity;
+    return (const RowHeader *)(m_Data + sizeof(FileHeader) + slot * m_RowSize);
+}
+
+/** Get time stamp and frequency band of a row. */
+bool CWaterfallHistory::rowInfo(int age, quint64 *time_ms, qint64 *center,
+                                float *bandwidth, int *bins) const
+{
+    const RowHeader *hdr = row(age);
+
+    if (!hdr)
+        return false;
+
+    if (time_ms)
+        *time_ms = hdr->time_ms;
+    if (center)
+        *center = hdr->center;
+    if (bandwidth)
+        *bandwidth = hdr->bandwidth;
+    if (bins)
+        *bins = hdr->bins;
+
+    return true;
+}
+
+/**
+ * @brief Draw a row into a waterfall line.
+ * @param age Age of the row, 0 is the newest.
+ * @param line Output pixels.
+ * @param width Number of pixels in line.
+ * @param start_freq Absolute frequency at the left edge of the line.
+ * @param stop_freq Absolute frequency at the right edge of the line.
+ * @param mindB Level drawn with colors[0].
+ * @param maxdB Level drawn with colors[255].
+ * @param colors The color table.
+ * @return FALSE if the row does not exist, line is left untouched then.
+ *
+ * Each pixel shows the peak of the bins it covers. Pixels outside of the
+ * band covered by the row are black.
+ */
+bool CWaterfallHistory::renderRow(int age, QRgb *line, int width,
+                                  qint64 start_freq, qint64 stop_freq,
+                                  float mindB, float maxdB,
+                                  const QRgb *colors) const
+{
+    const RowHeader *hdr = row(age);
+
+    if (!hdr || width <= 0)
+        return false;
+
+    const quint16  *data = (const quint16 *)(hdr + 1);
+    int     bins = hdr->bins;
+    double  bin_per_hz = bins / (double)hdr->bandwidth;
+    double  row_start = hdr->center - hdr->bandwidth / 2.0;
+    double  hz_per_px = (stop_freq - start_freq) / (double)width;
+
+    // color index = q * scale + offset
+    float   scale = 255.f / (WF_HISTORY_DB_SCALE * (maxdB - mindB));
+    float   offset = 255.f * (WF_HISTORY_MIN_DB - mindB) / (maxdB - mindB);
+    int     x, k;
+
+    for (x = 0; x < width; x++)
+    {
+        int b0 = (int)((start_freq + x * hz_per_px - row_start) * bin_per_hz);
+        int b1 = (int)((start_freq + (x + 1) * hz_per_px - row_start) * bin_per_hz);
+
+        if (b1 <= b0)
+            b1 = b0 + 1;
+        if (b0 < 0 || b1 > bins)
+        {
+            line[x] = qRgb(0, 0, 0);
+            continue;
+        }
+
+        quint16 peak = data[b0];
+        for (k = b0 + 1; k < b1; k++)
+            if (data[k] > peak)
+                peak = data[k];
+
+        line[x] = colors[(int)qBound(0.f, peak * scale + offset, 255.f)];
+    }
+
+    return true;
+}
@@ -0,0 +1,104 @@
+/* -*- c++ -*- */
+/*
+ * Gqrx SDR: Software defined radio receiver powered by GNU Radio and Qt
+ *           http://gqrx.dk/
+ *
+ * Copyright 2011-2020 Alexandru Csete OZ9AEC.
+ *
+ * Gqrx is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Gqrx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Gqrx; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef WATERFALL_HISTORY_H
+#define WATERFALL_HISTORY_H
+
+#include <QFile>
+#include <QRgb>
+#include <QString>
+#include <QtGlobal>
+
+#define WF_HISTORY_MAX_BINS     4096    /*! max number of bins stored per row */
+#define WF_HISTORY_MIN_DB       -200.f  /*! dB level of the quantized value 0 */
+#define WF_HISTORY_DB_SCALE     100.f   /*! quantization steps per dB */
+
+/**
+ * @brief Memory mapped ring file with the raw waterfall history.
+ *
+ * Each row holds the waterfall data in dB at FFT resolution (peak
+ * decimated to WF_HISTORY_MAX_BINS), quantized to 16 bits, together with
+ * its time stamp and the absolute frequency band it covers. Rows are
+ * addressed by age, 0 being the newest one.
+ *
+ * The class is not thread safe. The plotter accesses it with its
+ * waterfall lock held, except for writeRow() which may page in parts of
+ * the file and is therefore called with a separate lock.
+ */
+class CWaterfallHistory
+{
+public:
+    CWaterfallHistory();
+    ~CWaterfallHistory();
+
+    bool    open(const QString &filename, qint64 size);
+    void    close();
+    bool    isOpen() const { return m_Data != 0; }
+    void    clear();
+
+    void    beginRow();
+    void    writeRow(quint64 time_ms, qint64 center, float bandwidth,
+                     const float *data, int size);
+    void    commitRow();
+
+    /** Number of rows available. */
+    int     rows() const { return m_Count; }
+
+    /** Number of rows that fit into the file. */
+    int     capacity() const { return m_Capacity; }
+
+    bool    rowInfo(int age, quint64 *time_ms, qint64 *center,
+                    float *bandwidth, int *bins) const;
+    bool    renderRow(int age, QRgb *line, int width,
+                      qint64 start_freq, qint64 stop_freq,
+                      float mindB, float maxdB, const QRgb *colors) const;
+
+private:
+    struct RowHeader {
+        quint64     time_ms;
+        qint64      center;     /*! absolute center frequency in Hz */
+        float       bandwidth;  /*! bandwidth covered by the row in Hz */
+        quint32     bins;       /*! number of valid bins */
+    };
+
+    struct FileHeader {
+        char        magic[8];
+        quint32     version;
+        quint32     max_bins;
+        quint32     row_size;
+        quint32     capacity;
+        quint32     head;       /*! slot of the next row */
+        quint32     count;
+    };
+
+    const RowHeader *row(int age) const;
+
+    QFile       m_File;
+    uchar      *m_Data;         /*! mapped file */
+    FileHeader *m_Header;
+    qint64      m_RowSize;
+    int         m_Capacity;
+    int         m_Head;
+    int         m_Count;
+};
+
+#endif // WATERFALL_HISTORY_H
@@ -0,0 +1,298 @@
+/* -*- c++ -*- */
+/*
+ * Gqrx SDR: Software defined radio receiver powered by GNU Radio and Qt
+ *           http://gqrx.dk/
+ *
+ * Copyright 2011-2020 Alexandru Csete OZ9AEC.
+ *
+ * Gqrx is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Gqrx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Gqrx; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#include <cstring>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+#include <QVector>
+#include "waterfall_logger.h"
+
+CWaterfallLogger::CWaterfallLogger() :
+    m_Logging(false),
+    m_Quit(false),
+    m_Dropped(0),
+    m_GapRows(0),
+    m_GapStart(0),
+    m_GapEnd(0)
+{
+    m_Strip.rows = 0;
+}
+
+CWaterfallLogger::~CWaterfallLogger()
+{
+    stopLog();
+}
+
+/**
+ * @brief Start logging into a directory.
+ * @param dir The directory for the strips and the index file.
+ * @return TRUE if logging has been started.
+ */
+bool CWaterfallLogger::startLog(const QString &dir)
+{
+    stopLog();
+
+    if (!QDir().mkpath(dir))
+    {
+        qWarning() << "Can not create waterfall log directory" << dir;
+        return false;
+    }
+
+    QMutexLocker locker(&m_Mutex);
+    m_Dir = dir;
+    m_Strip.rows = 0;
+    m_Dropped = 0;
+    m_GapRows = 0;
+    m_Quit = false;
+    m_Logging = true;
+    locker.unlock();
+
+    start(QThread::LowestPriority);
+
+    return true;
+}
+
+/**
+ * @brief Stop logging. Rows that have been added are written before returning.
+ *
+ * A gap at the end of the log is recorded in the index as well, see
+ * writeGap(). droppedRows() keeps its value until the next startLog().
+ */
+void CWaterfallLogger::stopLog()
+{
+    QMutexLocker locker(&m_Mutex);
+
+    if (!m_Logging)
+        return;
+
+    closeStrip();
+    m_Logging = false;
+    m_Quit = true;
+    m_Cond.wakeOne();
+    locker.unlock();
+
+    wait();
+
+    // the encoder has finished, no need to hold the lock for the index
+    if (m_GapRows > 0)
+    {
+        writeGap(m_GapRows, m_GapStart, m_GapEnd);
+        m_GapRows = 0;
+    }
+}
+
+bool CWaterfallLogger::isLogging() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_Logging;
+}
+
+/** Number of rows lost because the encoder could not keep up. */
+quint64 CWaterfallLogger::droppedRows() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_Dropped;
+}
+
+/**
+ * @brief Add a waterfall row.
+ * @param time_ms Time stamp of the row.
+ * @param center Absolute center frequency of the data.
+ * @param bandwidth Bandwidth covered by the data.
+ * @param data FFT data in dB, lowest frequency first.
+ * @param size Number of FFT bins in data.
+ * @param mindB Level drawn with colors[0].
+ * @param maxdB Level drawn with colors[255].
+ * @param colors The color table.
+ *
+ * Data with more than WF_LOG_MAX_BINS bins is decimated keeping the peak
+ * value of each group of bins.
+ */
+void CWaterfallLogger::addRow(quint64 time_ms, qint64 center, float bandwidth,
+                              const float *data, int size,
+                              float mindB, float maxdB, const QRgb *colors)
+{
+    QMutexLocker locker(&m_Mutex);
+
+    if (!m_Logging || size <= 0)
+        return;
+
+    int     width = qMin(size, WF_LOG_MAX_BINS);
+    int     i, j, k;
+
+    if (m_Strip.rows > 0 &&
+        (m_Strip.image.width() != width || m_Strip.center != center ||
+         m_Strip.bandwidth != bandwidth || m_Strip.mindB != mindB ||
+         m_Strip.maxdB != maxdB ||
+         memcmp(m_Strip.image.colorTable().constData(), colors,
+                256 * sizeof(QRgb)) != 0))
+    {
+        closeStrip();
+    }
+
+    if (m_Strip.rows == 0)
+    {
+        if (m_Strip.image.width() != width)
+            m_Strip.image = QImage(width, WF_LOG_TILE_ROWS,
+                                   QImage::Format_Indexed8);
+        QVector<QRgb> table(256);
+        memcpy(table.data(), colors, 256 * sizeof(QRgb));
+        m_Strip.image.setColorTable(table);
+        m_Strip.start_ms = time_ms;
+        m_Strip.center = center;
+        m_Strip.bandwidth = bandwidth;
+        m_Strip.mindB = mindB;
+        m_Strip.maxdB = maxdB;
+    }
+
+    uchar  *line = m_Strip.image.scanLine(m_Strip.rows);
+    float   scale = 255.f / (maxdB - mindB);
+
+    for (i = 0, j = 0; i < width; i++)
+    {
+        int     end = (qint64)(i + 1) * size / width;
+        float   peak = data[j];
+
+        for (k = j + 1; k < end; k++)
+            if (data[k] > peak)
+                peak = data[k];
+        j = end;
+
+        line[i] = (uchar)qBound(0.f, (peak - mindB) * scale, 255.f);
+    }
+
+    m_Strip.end_ms = time_ms;
+    if (++m_Strip.rows == WF_LOG_TILE_ROWS)
+        closeStrip();
+}
+
+/** Hand the current strip over to the encoder (m_Mutex held). */
+void CWaterfallLogger::closeStrip()
+{
+    if (m_Strip.rows == 0)
+        return;
+
+    if (m_Queue.size() < WF_LOG_MAX_QUEUE)
+    {
+        // the strips dropped since the last one are noted before this one
+        m_Strip.gap_rows = m_GapRows;
+        m_Strip.gap_start_ms = m_GapStart;
+        m_Strip.gap_end_ms = m_GapEnd;
+        m_GapRows = 0;
+        m_Queue.append(m_Strip);
+        m_Cond.wakeOne();
+    }
+    else
+    {
+        if (m_GapRows == 0)
+            m_GapStart = m_Strip.start_ms;
+        m_GapEnd = m_Strip.end_ms;
+        m_GapRows += m_Strip.rows;
+        m_Dropped += m_Strip.rows;
+    }
+
+    // the queued strip keeps the image, start the next one on a new image
+    m_Strip.image = QImage();
+    m_Strip.rows = 0;
+}
+
+void CWaterfallLogger::run()
+{
+    QMutexLocker locker(&m_Mutex);
+
+    for (;;)
+    {
+        while (m_Queue.isEmpty() && !m_Quit)
+            m_Cond.wait(&m_Mutex);
+
+        if (m_Queue.isEmpty())
+            return;
+
+        Strip strip = m_Queue.takeFirst();
+
+        locker.unlock();
+        writeStrip(strip);
+        locker.relock();
+    }
+}
+
+/** Encode a strip and add it to the index (encoder thread). */
+void CWaterfallLogger::writeStrip(const Strip &strip)
+{
+    if (strip.gap_rows > 0)
+        writeGap(strip.gap_rows, strip.gap_start_ms, strip.gap_end_ms);
+
+    QDateTime   start(QDateTime::fromMSecsSinceEpoch(strip.start_ms, Qt::UTC));
+    QString     name(start.toString("gqrx_wf_yyyyMMdd_hhmmss_zzz.png"));
+    QImage      image(strip.rows < strip.image.height() ?
+                      strip.image.copy(0, 0, strip.image.width(), strip.rows) :
+                      strip.image);
+
+    if (!image.save(QString("%1/%2").arg(m_Dir).arg(name), "PNG"))
+    {
+        qWarning() << "Error writing waterfall strip" << name;
+        return;
+    }
+
+    QString     line;
+    QTextStream stream(&line);
+
+    stream << name << "; " << strip.start_ms << "; " << strip.end_ms << "; "
+           << strip.rows << "; " << strip.center << "; "
+           << (qint64)strip.bandwidth << "; " << strip.mindB << "; "
+           << strip.maxdB << "\n";
+    stream.flush();
+    writeIndex(line);
+}
+
+/**
+ * @brief Note rows that have been dropped in the index.
+ *
+ * The gap is written as a comment line so that readers of the index that
+ * skip comments are not affected.
+ */
+void CWaterfallLogger::writeGap(quint64 rows, quint64 start_ms, quint64 end_ms)
+{
+    writeIndex(QString("# dropped; %1; %2; %3\n")
+               .arg(start_ms).arg(end_ms).arg(rows));
+}
+
+/** Append a line to index.csv, the header is written with the first line. */
+void CWaterfallLogger::writeIndex(const QString &line)
+{
+    QFile   index(QString("%1/index.csv").arg(m_Dir));
+    bool    is_new = !index.exists();
+
+    if (!index.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+    {
+        qWarning() << "Error writing waterfall index" << index.errorString();
+        return;
+    }
+
+    QTextStream stream(&index);
+    if (is_new)
+        stream << "# file; start ms; end ms; rows; center Hz; bandwidth Hz; min dB; max dB\n";
+    stream << line;
+}
@@ -0,0 +1,101 @@
+/* -*- c++ -*- */
+/*
+ * Gqrx SDR: Software defined radio receiver powered by GNU Radio and Qt
+ *           http://gqrx.dk/
+ *
+ * Copyright 2011-2020 Alexandru Csete OZ9AEC.
+ *
+ * Gqrx is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Gqrx is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Gqrx; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+#ifndef WATERFALL_LOGGER_H
+#define WATERFALL_LOGGER_H
+
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+
+#define WF_LOG_MAX_BINS     4096    /*! max width of a strip */
+#define WF_LOG_TILE_ROWS    512     /*! max number of rows in a strip */
+#define WF_LOG_MAX_QUEUE    8       /*! max number of strips waiting to be written */
+
+/**
+ * @brief Write the waterfall to disk as a series of PNG strips.
+ *
+ * Rows are collected into strips of up to WF_LOG_TILE_ROWS lines, oldest
+ * line on top. A strip is closed early when the frequency band, the dB
+ * range or the colormap changes. Closed strips are encoded and written on
+ * a low priority thread; every strip gets a line in index.csv in the log
+ * directory.
+ *
+ * addRow() never blocks on the encoder. If the encoder falls behind by
+ * more than WF_LOG_MAX_QUEUE strips, new strips are dropped; the time span
+ * they covered is recorded in index.csv as "# dropped; start; end; rows".
+ */
+class CWaterfallLogger : public QThread
+{
+public:
+    CWaterfallLogger();
+    ~CWaterfallLogger();
+
+    bool    startLog(const QString &dir);
+    void    stopLog();
+    bool    isLogging() const;
+    quint64 droppedRows() const;
+
+    void    addRow(quint64 time_ms, qint64 center, float bandwidth,
+                   const float *data, int size,
+                   float mindB, float maxdB, const QRgb *colors);
+
+protected:
+    void    run();
+
+private:
+    struct Strip {
+        QImage      image;
+        int         rows;
+        quint64     start_ms;
+        quint64     end_ms;
+        qint64      center;
+        float       bandwidth;
+        float       mindB;
+        float       maxdB;
+        quint64     gap_rows;       /*! rows dropped just before this strip */
+        quint64     gap_start_ms;
+        quint64     gap_end_ms;
+    };
+
+    void    closeStrip();
+    void    writeStrip(const Strip &strip);
+    void    writeGap(quint64 rows, quint64 start_ms, quint64 end_ms);
+    void    writeIndex(const QString &line);
+
+    mutable QMutex  m_Mutex;
+    QWaitCondition  m_Cond;
+    QString         m_Dir;
+    bool            m_Logging;
+    bool            m_Quit;
+    Strip           m_Strip;    /*! strip being filled */
+    QList<Strip>    m_Queue;    /*! closed strips waiting to be written */
+    quint64         m_Dropped;
+    quint64         m_GapRows;  /*! rows dropped since the last queued strip */
+    quint64         m_GapStart;
+    quint64         m_GapEnd;
+};
+
+#endif // WATERFALL_LOGGER_H